@@ -18,7 +18,26 @@
 #define __NR_sys_vmsplice	316
 #endif
 
+#ifndef __NR_sys_io_uring_setup
+#define __NR_sys_io_uring_setup		425
+#define __NR_sys_io_uring_enter		426
+#define __NR_sys_io_uring_register	427
+#endif
+
+#ifndef __NR_preadv2
+#define __NR_preadv2		378
+#define __NR_pwritev2		379
+#endif
+
+#ifndef __NR_set_mempolicy
+#define __NR_set_mempolicy	276
+#endif
+
 #define nop	__asm__ __volatile__("rep;nop": : :"memory")
+#define read_barrier()	__asm__ __volatile__("lock; addl $0,0(%%esp)": : :"memory")
+#define write_barrier()	__asm__ __volatile__("": : :"memory")
+
+#define FIO_CACHELINE	64
 
 static inline unsigned long ffz(unsigned long bitmask)
 {
@@ -26,4 +45,91 @@ static inline unsigned long ffz(unsigned long bitmask)
 	return bitmask;
 }
 
+#define ARCH_HAVE_CPU_CLOCK
+
+static inline unsigned long long get_cpu_clock(void)
+{
+	unsigned int lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long long) hi << 32) | lo;
+}
+
+static inline void do_cpuid(unsigned int *eax, unsigned int *ebx,
+			    unsigned int *ecx, unsigned int *edx)
+{
+	__asm__ __volatile__("cpuid"
+		: "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+		: "0" (*eax), "2" (*ecx)
+		: "memory");
+}
+
+/*
+ * The tsc is only usable as a clock if it ticks at a constant rate,
+ * regardless of frequency scaling and C states.
+ */
+static inline int arch_cpu_clock_invariant(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	eax = 0x80000000;
+	ecx = 0;
+	do_cpuid(&eax, &ebx, &ecx, &edx);
+	if (eax < 0x80000007)
+		return 0;
+
+	eax = 0x80000007;
+	ecx = 0;
+	do_cpuid(&eax, &ebx, &ecx, &edx);
+	return (edx & (1U << 8)) != 0;
+}
+
+/*
+ * SSE4.2 has an instruction for crc32c, the Castagnoli polynomial
+ */
+#define ARCH_HAVE_CRC32C
+
+static inline int arch_have_crc32c(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	eax = 1;
+	ecx = 0;
+	do_cpuid(&eax, &ebx, &ecx, &edx);
+	return (ecx & (1U << 20)) != 0;
+}
+
+static inline unsigned int arch_crc32c_u8(unsigned int crc, unsigned char val)
+{
+	__asm__("crc32b %1,%0" : "+r" (crc) : "rm" (val));
+	return crc;
+}
+
+static inline unsigned int arch_crc32c_ulong(unsigned int crc,
+					     unsigned long val)
+{
+	__asm__("crc32l %1,%0" : "+r" (crc) : "rm" (val));
+	return crc;
+}
+
+/*
+ * Copy with non-temporal stores, so large copies don't evict the cache
+ */
+#define ARCH_HAVE_NT_COPY
+
+static inline void arch_memcpy_nt(void *dst, const void *src,
+				  unsigned long len)
+{
+	unsigned long *d = dst;
+	const unsigned long *s = src;
+
+	for (; len >= sizeof(*d); len -= sizeof(*d))
+		__asm__ __volatile__("movnti %1,%0" : "=m" (*d++) : "r" (*s++));
+
+	__asm__ __volatile__("sfence" : : : "memory");
+
+	if (len)
+		__builtin_memcpy(d, s, len);
+}
+
 #endif
@@ -39,4 +39,8 @@ static inline unsigned long generic_ffz(unsigned long word)
 
 #define BITS_PER_LONG	(__WORDSIZE)
 
+#ifndef FIO_CACHELINE
+#define FIO_CACHELINE	64
+#endif
+
 #endif
@@ -0,0 +1,214 @@
+/*
+ * Multi level bitmap, used for tracking which blocks of a file have seen io.
+ *
+ * A flat bitmap has to be scanned word by word to find a free block, which
+ * gets expensive on large devices as they fill up. Here every level above
+ * the first summarises the one below: bit n in level l+1 is set when word n
+ * in level l is full. Finding a free block is then a matter of following
+ * clear bits from the single top word down, one word per level.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "axmap.h"
+#include "arch.h"
+
+#define UNIT_BITS	(8 * sizeof(unsigned long))
+#define UNIT_SHIFT	(sizeof(unsigned long) == 8 ? 6 : 5)
+#define UNIT_MASK	(UNIT_BITS - 1)
+
+static void axmap_mark_full(struct axmap *axmap, unsigned int level,
+			    unsigned long long index)
+{
+	struct axmap_level *al;
+	unsigned long bit;
+
+	while (++level < axmap->nr_levels) {
+		al = &axmap->levels[level];
+		bit = 1UL << (index & UNIT_MASK);
+		index >>= UNIT_SHIFT;
+
+		al->map[index] |= bit;
+		if (al->map[index] != -1UL)
+			break;
+	}
+}
+
+/*
+ * Bits beyond the end of each level are marked used, so a search never
+ * lands on them.
+ */
+static void axmap_set_tail(struct axmap *axmap)
+{
+	unsigned long long bit, nr_bits = axmap->nr_bits;
+	unsigned int i;
+
+	for (i = 0; i < axmap->nr_levels; i++) {
+		struct axmap_level *al = &axmap->levels[i];
+
+		for (bit = nr_bits; bit & UNIT_MASK; bit++) {
+			al->map[bit >> UNIT_SHIFT] |= 1UL << (bit & UNIT_MASK);
+			if (al->map[bit >> UNIT_SHIFT] == -1UL)
+				axmap_mark_full(axmap, i, bit >> UNIT_SHIFT);
+		}
+
+		nr_bits = al->map_size;
+	}
+}
+
+void axmap_reset(struct axmap *axmap)
+{
+	unsigned int i;
+
+	for (i = 0; i < axmap->nr_levels; i++) {
+		struct axmap_level *al = &axmap->levels[i];
+
+		memset(al->map, 0, al->map_size * sizeof(unsigned long));
+	}
+
+	axmap_set_tail(axmap);
+}
+
+void axmap_free(struct axmap *axmap)
+{
+	unsigned int i;
+
+	if (!axmap)
+		return;
+
+	for (i = 0; i < axmap->nr_levels; i++)
+		free(axmap->levels[i].map);
+
+	free(axmap->levels);
+	free(axmap);
+}
+
+struct axmap *axmap_new(unsigned long long nr_bits)
+{
+	struct axmap *axmap;
+	unsigned long long bits;
+	unsigned int i, levels;
+
+	if (!nr_bits)
+		return NULL;
+
+	axmap = malloc(sizeof(*axmap));
+	if (!axmap)
+		return NULL;
+
+	levels = 1;
+	bits = (nr_bits + UNIT_BITS - 1) >> UNIT_SHIFT;
+	while (bits > 1) {
+		bits = (bits + UNIT_BITS - 1) >> UNIT_SHIFT;
+		levels++;
+	}
+
+	axmap->nr_levels = levels;
+	axmap->nr_bits = nr_bits;
+	axmap->levels = calloc(levels, sizeof(struct axmap_level));
+	if (!axmap->levels) {
+		free(axmap);
+		return NULL;
+	}
+
+	bits = nr_bits;
+	for (i = 0; i < levels; i++) {
+		struct axmap_level *al = &axmap->levels[i];
+
+		al->map_size = (bits + UNIT_BITS - 1) >> UNIT_SHIFT;
+		al->map = malloc(al->map_size * sizeof(unsigned long));
+		if (!al->map)
+			goto err;
+
+		bits = al->map_size;
+	}
+
+	axmap_reset(axmap);
+	return axmap;
+err:
+	axmap->nr_levels = i;
+	axmap_free(axmap);
+	return NULL;
+}
+
+int axmap_isset(struct axmap *axmap, unsigned long long bit)
+{
+	struct axmap_level *al = &axmap->levels[0];
+
+	if (bit >= axmap->nr_bits)
+		return 1;
+
+	return (al->map[bit >> UNIT_SHIFT] & (1UL << (bit & UNIT_MASK))) != 0;
+}
+
+/*
+ * Set up to nr_bits bits starting at bit, a word at a time. Stops at the
+ * first bit that is already set, and returns the number of bits set.
+ */
+unsigned int axmap_set_nr(struct axmap *axmap, unsigned long long bit,
+			  unsigned int nr_bits)
+{
+	struct axmap_level *al = &axmap->levels[0];
+	unsigned int set = 0;
+
+	if (bit >= axmap->nr_bits)
+		return 0;
+	if (nr_bits > axmap->nr_bits - bit)
+		nr_bits = axmap->nr_bits - bit;
+
+	while (set < nr_bits) {
+		unsigned long long index = bit >> UNIT_SHIFT;
+		unsigned int offset = bit & UNIT_MASK;
+		unsigned int nr = UNIT_BITS - offset;
+		unsigned long mask, overlap;
+
+		if (nr > nr_bits - set)
+			nr = nr_bits - set;
+
+		if (nr == UNIT_BITS)
+			mask = -1UL;
+		else
+			mask = ((1UL << nr) - 1) << offset;
+
+		/*
+		 * Only set up to the first used bit
+		 */
+		overlap = al->map[index] & mask;
+		if (overlap) {
+			nr = ffz(~overlap) - offset;
+			mask &= ~(-1UL << (offset + nr));
+		}
+
+		al->map[index] |= mask;
+		if (al->map[index] == -1UL)
+			axmap_mark_full(axmap, 0, index);
+
+		set += nr;
+		bit += nr;
+		if (overlap)
+			break;
+	}
+
+	return set;
+}
+
+/*
+ * Walk down from the top level, following the first word that isn't full.
+ * Returns -1ULL if every bit is set.
+ */
+unsigned long long axmap_first_free(struct axmap *axmap)
+{
+	unsigned long long index = 0;
+	int level;
+
+	for (level = axmap->nr_levels - 1; level >= 0; level--) {
+		struct axmap_level *al = &axmap->levels[level];
+
+		if (al->map[index] == -1UL)
+			return -1ULL;
+
+		index = (index << UNIT_SHIFT) + ffz(al->map[index]);
+	}
+
+	return index;
+}
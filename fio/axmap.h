@@ -0,0 +1,26 @@
+#ifndef FIO_AXMAP_H
+#define FIO_AXMAP_H
+
+/*
+ * Multi level bitmap. Level 0 holds a bit per block, each level above holds
+ * a bit per word below that is completely set.
+ */
+struct axmap_level {
+	unsigned long *map;
+	unsigned long map_size;
+};
+
+struct axmap {
+	unsigned int nr_levels;
+	struct axmap_level *levels;
+	unsigned long long nr_bits;
+};
+
+extern struct axmap *axmap_new(unsigned long long);
+extern void axmap_free(struct axmap *);
+extern void axmap_reset(struct axmap *);
+extern int axmap_isset(struct axmap *, unsigned long long);
+extern unsigned int axmap_set_nr(struct axmap *, unsigned long long, unsigned int);
+extern unsigned long long axmap_first_free(struct axmap *);
+
+#endif
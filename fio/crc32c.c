@@ -0,0 +1,118 @@
+/*
+ * crc32c, the Castagnoli polynomial. Uses the SSE4.2 crc32 instruction
+ * where the cpu has it, and a slice-by-8 table version otherwise. Both
+ * give the same result, so data verified on one machine checks out on
+ * another.
+ */
+#include <string.h>
+
+#include "crc32c.h"
+#include "arch.h"
+
+#define CRC32C_POLY	0x82f63b78
+
+static uint32_t crc32c_table[8][256];
+static int crc32c_probed;
+static int crc32c_use_hw;
+
+static void crc32c_init(void)
+{
+	uint32_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+		crc32c_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++) {
+		crc = crc32c_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+			crc32c_table[j][i] = crc;
+		}
+	}
+
+#ifdef ARCH_HAVE_CRC32C
+	crc32c_use_hw = arch_have_crc32c();
+#endif
+	crc32c_probed = 1;
+}
+
+int crc32c_hw_available(void)
+{
+	if (!crc32c_probed)
+		crc32c_init();
+
+	return crc32c_use_hw;
+}
+
+/*
+ * Eight bytes per step, using a table for each byte position. Assumes a
+ * little endian cpu for the word loads.
+ */
+uint32_t crc32c_sw(const void *buf, unsigned long len)
+{
+	const unsigned char *p = buf;
+	uint32_t crc = ~0U, lo, hi;
+
+	if (!crc32c_probed)
+		crc32c_init();
+
+	while (len >= 8) {
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc;
+		crc = crc32c_table[7][lo & 0xff] ^
+		      crc32c_table[6][(lo >> 8) & 0xff] ^
+		      crc32c_table[5][(lo >> 16) & 0xff] ^
+		      crc32c_table[4][lo >> 24] ^
+		      crc32c_table[3][hi & 0xff] ^
+		      crc32c_table[2][(hi >> 8) & 0xff] ^
+		      crc32c_table[1][(hi >> 16) & 0xff] ^
+		      crc32c_table[0][hi >> 24];
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+#ifdef ARCH_HAVE_CRC32C
+uint32_t crc32c_hw(const void *buf, unsigned long len)
+{
+	const unsigned char *p = buf;
+	unsigned int crc = ~0U;
+	unsigned long val;
+
+	while (len >= sizeof(val)) {
+		memcpy(&val, p, sizeof(val));
+		crc = arch_crc32c_ulong(crc, val);
+		p += sizeof(val);
+		len -= sizeof(val);
+	}
+
+	while (len--)
+		crc = arch_crc32c_u8(crc, *p++);
+
+	return ~crc;
+}
+#else
+uint32_t crc32c_hw(const void *buf, unsigned long len)
+{
+	return crc32c_sw(buf, len);
+}
+#endif
+
+uint32_t crc32c(const void *buf, unsigned long len)
+{
+	if (crc32c_hw_available())
+		return crc32c_hw(buf, len);
+
+	return crc32c_sw(buf, len);
+}
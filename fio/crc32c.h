@@ -0,0 +1,11 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+
+extern uint32_t crc32c(const void *, unsigned long);
+extern uint32_t crc32c_sw(const void *, unsigned long);
+extern uint32_t crc32c_hw(const void *, unsigned long);
+extern int crc32c_hw_available(void);
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * Skewed distributions for file and offset selection. The distribution is
+ * turned in to a probability per item up front, and an alias table is
+ * built from that, so picking the next item is O(1) for all of them.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "dist.h"
+
+int dist_parse(const char *str, struct fio_dist *d)
+{
+	char *end;
+
+	memset(d, 0, sizeof(*d));
+
+	if (!strncmp(str, "random", 6)) {
+		d->type = FIO_DIST_UNIFORM;
+		return 0;
+	} else if (!strncmp(str, "zipf:", 5)) {
+		d->type = FIO_DIST_ZIPF;
+		d->val = strtod(str + 5, &end);
+		if (end == str + 5 || d->val <= 0.0)
+			return 1;
+		return 0;
+	} else if (!strncmp(str, "pareto:", 7)) {
+		d->type = FIO_DIST_PARETO;
+		d->val = strtod(str + 7, &end);
+		if (end == str + 7 || d->val <= 0.0 || d->val >= 1.0)
+			return 1;
+		return 0;
+	} else if (!strncmp(str, "hotcold:", 8)) {
+		d->type = FIO_DIST_HOTCOLD;
+		d->val = strtod(str + 8, &end);
+		if (end == str + 8 || *end != '/')
+			return 1;
+		str = end + 1;
+		d->val2 = strtod(str, &end);
+		if (end == str)
+			return 1;
+		if (d->val <= 0.0 || d->val >= 100.0 ||
+		    d->val2 <= 0.0 || d->val2 >= 100.0)
+			return 1;
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Weight of the item of rank k, out of nr
+ */
+static double dist_weight(struct fio_dist *d, unsigned int k, unsigned int nr,
+			  double *weights)
+{
+	double e, hot;
+
+	switch (d->type) {
+	case FIO_DIST_ZIPF:
+		return pow(k + 1, -d->val);
+	case FIO_DIST_PARETO:
+		/*
+		 * the first x of the items get x^e of the ios, with e
+		 * picked so that the first 1-h get h of them
+		 */
+		e = log(d->val) / log(1.0 - d->val);
+		return pow((double) (k + 1) / nr, e) - pow((double) k / nr, e);
+	case FIO_DIST_HOTCOLD:
+		hot = floor(nr * d->val2 / 100.0);
+		if (hot < 1.0)
+			hot = 1.0;
+		if (hot >= nr)
+			return 1.0;
+		if (k < hot)
+			return d->val / hot;
+		return (100.0 - d->val) / (nr - hot);
+	case FIO_DIST_WEIGHTED:
+		return weights[k];
+	default:
+		return 1.0;
+	}
+}
+
+/*
+ * Build the alias table for nr items. If fs is given, the ranks are
+ * shuffled over the items, so the popular ones end up spread out rather
+ * than all at the start.
+ */
+int dist_alias_init(struct fio_alias *fa, struct fio_dist *d, unsigned int nr,
+		    double *weights, struct frand_state *fs)
+{
+	unsigned int *small, *large, nr_small, nr_large, i, j, s, l;
+	double *p, sum, tmp;
+
+	memset(fa, 0, sizeof(*fa));
+
+	p = malloc(nr * sizeof(double));
+	small = malloc(nr * sizeof(unsigned int));
+	large = malloc(nr * sizeof(unsigned int));
+	fa->cut = malloc(nr * sizeof(uint32_t));
+	fa->alias = malloc(nr * sizeof(uint32_t));
+	if (!p || !small || !large || !fa->cut || !fa->alias)
+		goto err;
+
+	sum = 0.0;
+	for (i = 0; i < nr; i++) {
+		p[i] = dist_weight(d, i, nr, weights);
+		sum += p[i];
+	}
+
+	if (sum <= 0.0)
+		goto err;
+
+	if (fs) {
+		for (i = nr - 1; i > 0; i--) {
+			j = ((frand_next(fs) >> 32) * (i + 1)) >> 32;
+			tmp = p[i];
+			p[i] = p[j];
+			p[j] = tmp;
+		}
+	}
+
+	/*
+	 * scale so the average item is 1.0, then pair each item below that
+	 * with one above it to fill up its slot
+	 */
+	nr_small = nr_large = 0;
+	for (i = 0; i < nr; i++) {
+		p[i] = p[i] * nr / sum;
+		if (p[i] < 1.0)
+			small[nr_small++] = i;
+		else
+			large[nr_large++] = i;
+	}
+
+	while (nr_small && nr_large) {
+		s = small[--nr_small];
+		l = large[nr_large - 1];
+
+		fa->cut[s] = (uint32_t) (p[s] * 4294967296.0);
+		fa->alias[s] = l;
+
+		p[l] -= 1.0 - p[s];
+		if (p[l] < 1.0) {
+			nr_large--;
+			small[nr_small++] = l;
+		}
+	}
+
+	/*
+	 * what's left is full, bar rounding errors
+	 */
+	while (nr_large) {
+		l = large[--nr_large];
+		fa->cut[l] = UINT32_MAX;
+		fa->alias[l] = l;
+	}
+	while (nr_small) {
+		s = small[--nr_small];
+		fa->cut[s] = UINT32_MAX;
+		fa->alias[s] = s;
+	}
+
+	fa->nr = nr;
+	free(p);
+	free(small);
+	free(large);
+	return 0;
+err:
+	free(p);
+	free(small);
+	free(large);
+	dist_alias_free(fa);
+	return 1;
+}
+
+void dist_alias_free(struct fio_alias *fa)
+{
+	free(fa->cut);
+	free(fa->alias);
+	fa->cut = fa->alias = NULL;
+	fa->nr = 0;
+}
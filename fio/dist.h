@@ -0,0 +1,50 @@
+#ifndef FIO_DIST_H
+#define FIO_DIST_H
+
+#include "rand.h"
+
+/*
+ * Skewed access distributions, for picking files and offsets
+ */
+enum fio_dist_type {
+	FIO_DIST_NONE = 0,	/* default, round robin files / random map */
+	FIO_DIST_UNIFORM,
+	FIO_DIST_ZIPF,		/* zipf:theta */
+	FIO_DIST_PARETO,	/* pareto:h, h of the ios go to 1-h of the data */
+	FIO_DIST_HOTCOLD,	/* hotcold:io%/data% */
+	FIO_DIST_WEIGHTED,	/* explicit per item weights */
+};
+
+struct fio_dist {
+	enum fio_dist_type type;
+	double val;
+	double val2;
+};
+
+/*
+ * Walker alias table. A sample is a uniform pick of a slot, then a coin
+ * flip between the slot itself and its alias, so it's O(1) whatever the
+ * distribution.
+ */
+struct fio_alias {
+	unsigned int nr;
+	uint32_t *cut;
+	uint32_t *alias;
+};
+
+extern int dist_parse(const char *, struct fio_dist *);
+extern int dist_alias_init(struct fio_alias *, struct fio_dist *, unsigned int, double *, struct frand_state *);
+extern void dist_alias_free(struct fio_alias *);
+
+static inline unsigned int dist_alias_next(struct fio_alias *fa,
+					   struct frand_state *fs)
+{
+	unsigned int slot = ((frand_next(fs) >> 32) * fa->nr) >> 32;
+
+	if ((uint32_t) (frand_next(fs) >> 32) < fa->cut[slot])
+		return slot;
+
+	return fa->alias[slot];
+}
+
+#endif
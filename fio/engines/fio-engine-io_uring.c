@@ -0,0 +1,577 @@
+/*
+ * io_uring io engine
+ *
+ * Talks to the kernel through the raw io_uring_setup/enter/register
+ * system calls. The io buffers and the job files are registered with the
+ * ring up front, so the kernel doesn't have to map/pin the pages or grab
+ * a file reference for every io. Queued io_u's are only made visible to
+ * the kernel through the shared submission ring, ->commit() submits the
+ * whole batch with a single system call. With sqthread_poll, a kernel
+ * thread polls the submission ring and we don't need a system call to
+ * submit at all.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "../fio.h"
+#include "../os.h"
+
+#ifdef FIO_HAVE_IOURING
+
+struct io_sq_ring {
+	unsigned int *head;
+	unsigned int *tail;
+	unsigned int *ring_mask;
+	unsigned int *ring_entries;
+	unsigned int *flags;
+	unsigned int *array;
+};
+
+struct io_cq_ring {
+	unsigned int *head;
+	unsigned int *tail;
+	unsigned int *ring_mask;
+	unsigned int *ring_entries;
+	struct io_uring_cqe *cqes;
+};
+
+struct ioring_mmap {
+	void *ptr;
+	size_t len;
+};
+
+struct ioring_data {
+	int ring_fd;
+
+	struct io_sq_ring sq_ring;
+	struct io_uring_sqe *sqes;
+	struct iovec *iovecs;
+	unsigned int sq_ring_mask;
+
+	struct io_cq_ring cq_ring;
+	unsigned int cq_ring_mask;
+	unsigned int cq_ring_off;
+
+	/*
+	 * sqes filled in by ->queue(), but not yet submitted to the kernel
+	 */
+	unsigned int queued;
+
+	int fixedbufs;
+	int fixedfiles;
+	int files_registered;
+
+	/*
+	 * the kernel takes a timeout for waiting on completions
+	 */
+	int ext_arg;
+
+	struct ioring_mmap mmap[3];
+};
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_sys_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(struct ioring_data *ld, unsigned int to_submit,
+			  unsigned int min_complete, unsigned int flags,
+			  void *arg, size_t argsz)
+{
+	return syscall(__NR_sys_io_uring_enter, ld->ring_fd, to_submit,
+			min_complete, flags, arg, argsz);
+}
+
+static int io_uring_register(struct ioring_data *ld, unsigned int opcode,
+			     void *arg, unsigned int nr_args)
+{
+	return syscall(__NR_sys_io_uring_register, ld->ring_fd, opcode, arg,
+			nr_args);
+}
+
+/*
+ * Register the job files with the ring. This can't be done from ->init(),
+ * as the files aren't opened until after the engine has been set up.
+ */
+static int fio_ioring_register_files(struct thread_data *td)
+{
+	struct ioring_data *ld = td->io_ops->data;
+	struct fio_file *f;
+	int *fds, i, ret;
+
+	fds = malloc(td->nr_files * sizeof(int));
+	for_each_file(td, f, i)
+		fds[i] = f->fd;
+
+	ret = io_uring_register(ld, IORING_REGISTER_FILES, fds, td->nr_files);
+	free(fds);
+
+	if (ret < 0)
+		return errno;
+
+	ld->files_registered = 1;
+	return 0;
+}
+
+static int fio_ioring_prep(struct thread_data *td, struct io_u *io_u)
+{
+	struct ioring_data *ld = td->io_ops->data;
+	struct io_uring_sqe *sqe = &ld->sqes[io_u->index];
+	struct fio_file *f = io_u->file;
+
+	if (ld->fixedfiles && !ld->files_registered) {
+		int ret = fio_ioring_register_files(td);
+
+		if (ret) {
+			/*
+			 * a polled submission ring can't be used without
+			 * registered files on older kernels, so fail hard.
+			 */
+			if (td->sqthread_poll) {
+				td_verror(td, ret);
+				return 1;
+			}
+			log_err("fio: io_uring file registration failed, using plain files\n");
+			ld->fixedfiles = 0;
+		}
+	}
+
+	memset(sqe, 0, sizeof(*sqe));
+
+	if (ld->fixedfiles) {
+		sqe->fd = f - td->files;
+		sqe->flags = IOSQE_FIXED_FILE;
+	} else
+		sqe->fd = f->fd;
+
+	if (io_u->ddir == DDIR_READ || io_u->ddir == DDIR_WRITE) {
+		if (ld->fixedbufs) {
+			if (io_u->ddir == DDIR_READ)
+				sqe->opcode = IORING_OP_READ_FIXED;
+			else
+				sqe->opcode = IORING_OP_WRITE_FIXED;
+			sqe->addr = (unsigned long) io_u->buf;
+			sqe->len = io_u->buflen;
+			sqe->buf_index = io_u->index;
+		} else {
+			struct iovec *iov = &ld->iovecs[io_u->index];
+
+			if (io_u->ddir == DDIR_READ)
+				sqe->opcode = IORING_OP_READV;
+			else
+				sqe->opcode = IORING_OP_WRITEV;
+			iov->iov_base = io_u->buf;
+			iov->iov_len = io_u->buflen;
+			sqe->addr = (unsigned long) iov;
+			sqe->len = 1;
+		}
+		sqe->off = io_u->offset;
+	} else if (io_u->ddir == DDIR_SYNC)
+		sqe->opcode = IORING_OP_FSYNC;
+	else
+		return 1;
+
+	sqe->user_data = (unsigned long) io_u;
+	return 0;
+}
+
+static struct io_u *fio_ioring_event(struct thread_data *td, int event)
+{
+	struct ioring_data *ld = td->io_ops->data;
+	struct io_uring_cqe *cqe;
+	struct io_u *io_u;
+	unsigned int index;
+
+	index = (event + ld->cq_ring_off) & ld->cq_ring_mask;
+
+	cqe = &ld->cq_ring.cqes[index];
+	io_u = (struct io_u *) (unsigned long) cqe->user_data;
+
+	if (cqe->res < 0)
+		io_u->error = -cqe->res;
+	else if ((unsigned int) cqe->res != io_u->buflen) {
+		io_u->resid = io_u->buflen - cqe->res;
+		io_u->error = EIO;
+	}
+
+	return io_u;
+}
+
+/*
+ * Consume up to max - events completions from the completion ring. The
+ * entries stay valid for ->event() until the next batch is submitted,
+ * since we never have more io in flight than the ring has room for.
+ */
+static unsigned int fio_ioring_cqring_reap(struct thread_data *td,
+					   unsigned int events,
+					   unsigned int max)
+{
+	struct ioring_data *ld = td->io_ops->data;
+	struct io_cq_ring *ring = &ld->cq_ring;
+	unsigned int head, reaped = 0;
+
+	head = *ring->head;
+	while (reaped + events < max) {
+		read_barrier();
+		if (head == *ring->tail)
+			break;
+		reaped++;
+		head++;
+	}
+
+	*ring->head = head;
+	write_barrier();
+	return reaped;
+}
+
+/*
+ * Submit what has been queued and wait for 'wait' completions, in the
+ * same system call.
+ */
+/*
+ * Submit what's queued, and wait for wait completions. If ts is given, the
+ * wait ends there, which isn't an error.
+ */
+static int fio_ioring_enter(struct thread_data *td, unsigned int wait,
+			    struct timespec *ts)
+{
+	struct ioring_data *ld = td->io_ops->data;
+	unsigned int flags = 0;
+	void *arg = NULL;
+	size_t argsz = 0;
+	int ret;
+#ifdef IORING_FEAT_EXT_ARG
+	struct io_uring_getevents_arg ea;
+	struct __kernel_timespec kts;
+
+	if (wait && ts) {
+		kts.tv_sec = ts->tv_sec;
+		kts.tv_nsec = ts->tv_nsec;
+		memset(&ea, 0, sizeof(ea));
+		ea.ts = (unsigned long) &kts;
+		flags |= IORING_ENTER_EXT_ARG;
+		arg = &ea;
+		argsz = sizeof(ea);
+	}
+#endif
+
+	if (wait)
+		flags |= IORING_ENTER_GETEVENTS;
+
+	if (td->sqthread_poll) {
+		/*
+		 * the kernel thread picks up the new tail on its own, it
+		 * just needs a kick if it went to sleep.
+		 */
+		if (ld->queued) {
+			read_barrier();
+			if (*ld->sq_ring.flags & IORING_SQ_NEED_WAKEUP)
+				flags |= IORING_ENTER_SQ_WAKEUP;
+			ld->queued = 0;
+		}
+		if (!flags)
+			return 0;
+	}
+
+	ret = io_uring_enter(ld, ld->queued, wait, flags, arg, argsz);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR || errno == ETIME)
+			return 0;
+
+		return -errno;
+	}
+
+	if (!td->sqthread_poll)
+		ld->queued -= ret;
+
+	return 0;
+}
+
+/*
+ * Wait for at least min events, or until t has passed if given. The rate
+ * and iolog replay code wait for their next arrival this way. Kernels
+ * that can't time out the wait are polled instead.
+ */
+static int fio_ioring_getevents(struct thread_data *td, int min, int max,
+				struct timespec *t)
+{
+	struct ioring_data *ld = td->io_ops->data;
+	unsigned long long timeout = 0, spent;
+	struct timespec start, left, *tp;
+	unsigned int events = 0, nr;
+	int ret;
+
+	ld->cq_ring_off = *ld->cq_ring.head;
+
+	if (t) {
+		timeout = t->tv_sec * 1000000000ULL + t->tv_nsec;
+		fio_gettime(&start, NULL);
+	}
+
+	do {
+		unsigned int wait = 0;
+
+		tp = NULL;
+		if ((int) events < min)
+			wait = min - events;
+
+		if (wait && t) {
+			spent = ntime_since_now(&start);
+			if (spent >= timeout)
+				break;
+			left.tv_sec = (timeout - spent) / 1000000000ULL;
+			left.tv_nsec = (timeout - spent) % 1000000000ULL;
+			tp = &left;
+			if (!ld->ext_arg)
+				wait = 0;
+		}
+
+		if (ld->queued || wait) {
+			ret = fio_ioring_enter(td, wait, tp);
+			if (ret < 0)
+				return ret;
+		}
+
+		nr = fio_ioring_cqring_reap(td, events, max);
+		events += nr;
+
+		/*
+		 * no timed wait in the kernel, nap a little and look again
+		 */
+		if (!nr && tp && !ld->ext_arg)
+			usleep(left.tv_sec || left.tv_nsec > 100000 ? 100 : left.tv_nsec / 1000);
+	} while ((int) events < min);
+
+	return events;
+}
+
+static int fio_ioring_commit(struct thread_data *td)
+{
+	struct ioring_data *ld = td->io_ops->data;
+	int ret;
+
+	while (ld->queued) {
+		ret = fio_ioring_enter(td, 0, NULL);
+		if (ret < 0)
+			return -ret;
+	}
+
+	return 0;
+}
+
+static int fio_ioring_queue(struct thread_data *td, struct io_u *io_u)
+{
+	struct ioring_data *ld = td->io_ops->data;
+	struct io_sq_ring *ring = &ld->sq_ring;
+	unsigned int tail, next_tail;
+
+	tail = *ring->tail;
+	next_tail = tail + 1;
+	read_barrier();
+	if (next_tail - *ring->head > *ring->ring_entries) {
+		io_u->error = EBUSY;
+		return io_u->error;
+	}
+
+	ring->array[tail & ld->sq_ring_mask] = io_u->index;
+	write_barrier();
+	*ring->tail = next_tail;
+	write_barrier();
+
+	ld->queued++;
+	return 0;
+}
+
+static void fio_ioring_unmap(struct ioring_data *ld)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(ld->mmap) / sizeof(ld->mmap[0]); i++) {
+		if (ld->mmap[i].ptr)
+			munmap(ld->mmap[i].ptr, ld->mmap[i].len);
+	}
+}
+
+static void fio_ioring_cleanup(struct thread_data *td)
+{
+	struct ioring_data *ld = td->io_ops->data;
+
+	if (ld) {
+		fio_ioring_unmap(ld);
+		if (ld->ring_fd != -1)
+			close(ld->ring_fd);
+		free(ld->iovecs);
+		free(ld);
+		td->io_ops->data = NULL;
+	}
+}
+
+static int fio_ioring_mmap(struct ioring_data *ld, struct io_uring_params *p)
+{
+	struct io_sq_ring *sring = &ld->sq_ring;
+	struct io_cq_ring *cring = &ld->cq_ring;
+	void *ptr;
+
+	ld->mmap[0].len = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+	ptr = mmap(NULL, ld->mmap[0].len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ld->ring_fd,
+			IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+		return errno;
+	ld->mmap[0].ptr = ptr;
+	sring->head = ptr + p->sq_off.head;
+	sring->tail = ptr + p->sq_off.tail;
+	sring->ring_mask = ptr + p->sq_off.ring_mask;
+	sring->ring_entries = ptr + p->sq_off.ring_entries;
+	sring->flags = ptr + p->sq_off.flags;
+	sring->array = ptr + p->sq_off.array;
+	ld->sq_ring_mask = *sring->ring_mask;
+
+	ld->mmap[1].len = p->sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, ld->mmap[1].len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ld->ring_fd,
+			IORING_OFF_SQES);
+	if (ptr == MAP_FAILED)
+		return errno;
+	ld->mmap[1].ptr = ptr;
+	ld->sqes = ptr;
+
+	ld->mmap[2].len = p->cq_off.cqes +
+				p->cq_entries * sizeof(struct io_uring_cqe);
+	ptr = mmap(NULL, ld->mmap[2].len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ld->ring_fd,
+			IORING_OFF_CQ_RING);
+	if (ptr == MAP_FAILED)
+		return errno;
+	ld->mmap[2].ptr = ptr;
+	cring->head = ptr + p->cq_off.head;
+	cring->tail = ptr + p->cq_off.tail;
+	cring->ring_mask = ptr + p->cq_off.ring_mask;
+	cring->ring_entries = ptr + p->cq_off.ring_entries;
+	cring->cqes = ptr + p->cq_off.cqes;
+	ld->cq_ring_mask = *cring->ring_mask;
+	return 0;
+}
+
+/*
+ * Register one fixed buffer per io_u. They are all carved out of
+ * td->orig_buffer, so the pages get pinned once for the life of the job.
+ */
+static int fio_ioring_register_buffers(struct thread_data *td)
+{
+	struct ioring_data *ld = td->io_ops->data;
+	unsigned int max_bs = max(td->max_bs[DDIR_READ], td->max_bs[DDIR_WRITE]);
+	struct io_u *io_u;
+	unsigned int i;
+
+	for (i = 0; i < td->io_u_nr; i++) {
+		io_u = &td->io_us[i];
+
+		ld->iovecs[io_u->index].iov_base = io_u->buf;
+		ld->iovecs[io_u->index].iov_len = max_bs;
+	}
+
+	if (io_uring_register(ld, IORING_REGISTER_BUFFERS, ld->iovecs,
+				td->iodepth) < 0)
+		return errno;
+
+	return 0;
+}
+
+static int fio_ioring_init(struct thread_data *td)
+{
+	struct ioring_data *ld = malloc(sizeof(*ld));
+	struct io_uring_params p;
+	int ret;
+
+	memset(ld, 0, sizeof(*ld));
+	ld->iovecs = malloc(td->iodepth * sizeof(struct iovec));
+	memset(ld->iovecs, 0, td->iodepth * sizeof(struct iovec));
+	td->io_ops->data = ld;
+
+	memset(&p, 0, sizeof(p));
+	if (td->sqthread_poll)
+		p.flags |= IORING_SETUP_SQPOLL;
+
+	ld->ring_fd = io_uring_setup(td->iodepth, &p);
+	if (ld->ring_fd < 0) {
+		td_verror(td, errno);
+		goto err;
+	}
+
+	ret = fio_ioring_mmap(ld, &p);
+	if (ret) {
+		td_verror(td, ret);
+		goto err;
+	}
+
+#ifdef IORING_FEAT_EXT_ARG
+	ld->ext_arg = !!(p.features & IORING_FEAT_EXT_ARG);
+#endif
+
+	/*
+	 * Fixed buffers need the pages locked down, which may run into
+	 * RLIMIT_MEMLOCK. That's not fatal, just fall back to normal io.
+	 */
+	ld->fixedbufs = 1;
+	ret = fio_ioring_register_buffers(td);
+	if (ret) {
+		log_err("fio: io_uring buffer registration failed (%s), using plain buffers\n", strerror(ret));
+		ld->fixedbufs = 0;
+	}
+
+	ld->fixedfiles = 1;
+	return 0;
+err:
+	fio_ioring_cleanup(td);
+	return 1;
+}
+
+static struct ioengine_ops ioengine = {
+	.name		= "io_uring",
+	.version	= FIO_IOOPS_VERSION,
+	.init		= fio_ioring_init,
+	.prep		= fio_ioring_prep,
+	.queue		= fio_ioring_queue,
+	.commit		= fio_ioring_commit,
+	.getevents	= fio_ioring_getevents,
+	.event		= fio_ioring_event,
+	.cleanup	= fio_ioring_cleanup,
+};
+
+#else /* FIO_HAVE_IOURING */
+
+/*
+ * When we have a proper configure system in place, we simply wont build
+ * and install this io engine. For now install a crippled version that
+ * just complains and fails to load.
+ */
+static int fio_ioring_init(struct thread_data fio_unused *td)
+{
+	fprintf(stderr, "fio: io_uring not available\n");
+	return 1;
+}
+
+static struct ioengine_ops ioengine = {
+	.name		= "io_uring",
+	.version	= FIO_IOOPS_VERSION,
+	.init		= fio_ioring_init,
+};
+
+#endif
+
+static void fio_init fio_ioring_register(void)
+{
+	register_ioengine(&ioengine);
+}
+
+static void fio_exit fio_ioring_unregister(void)
+{
+	unregister_ioengine(&ioengine);
+}
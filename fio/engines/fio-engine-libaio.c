@@ -13,11 +13,23 @@
 
 #ifdef FIO_HAVE_LIBAIO
 
-#define ev_to_iou(ev)	(struct io_u *) ((unsigned long) (ev)->obj)
+/*
+ * the iocb lives in the engine union at the end of the io_u
+ */
+#define ev_to_iou(ev)	container_of((ev)->obj, struct io_u, iocb)
 
 struct libaio_data {
 	io_context_t aio_ctx;
 	struct io_event *aio_events;
+	struct iocb **iocbs;
+	struct io_u **io_us;
+	int queued;
+
+	/*
+	 * ios the kernel didn't take, they complete on the next reap
+	 */
+	struct io_u **failed;
+	int nr_failed;
 };
 
 static int fio_libaio_prep(struct thread_data fio_unused *td, struct io_u *io_u)
@@ -47,10 +59,23 @@ static int fio_libaio_getevents(struct thread_data *td, int min, int max,
 				struct timespec *t)
 {
 	struct libaio_data *ld = td->io_ops->data;
+	int nr;
 	long r;
 
+	for (nr = 0; nr < ld->nr_failed && nr < max; nr++)
+		ld->aio_events[nr].obj = &ld->failed[nr]->iocb;
+
+	if (nr) {
+		ld->nr_failed -= nr;
+		memmove(ld->failed, ld->failed + nr, ld->nr_failed * sizeof(struct io_u *));
+		if (nr >= min || nr == max)
+			return nr;
+		min -= nr;
+		max -= nr;
+	}
+
 	do {
-		r = io_getevents(ld->aio_ctx, min, max, ld->aio_events, t);
+		r = io_getevents(ld->aio_ctx, min, max, ld->aio_events + nr, t);
 		if (r == -EAGAIN) {
 			usleep(100);
 			continue;
@@ -61,36 +86,62 @@ static int fio_libaio_getevents(struct thread_data *td, int min, int max,
 	} while (1);
 
 	if (r < 0)
-		r = -r;
+		return (int) -r;
 
-	return (int) r;
+	return nr + (int) r;
 }
 
 static int fio_libaio_queue(struct thread_data *td, struct io_u *io_u)
 {
 	struct libaio_data *ld = td->io_ops->data;
-	struct iocb *iocb = &io_u->iocb;
-	long ret;
 
-	do {
-		ret = io_submit(ld->aio_ctx, 1, &iocb);
-		if (ret == 1)
-			return 0;
-		else if (ret == -EAGAIN || !ret)
+	/*
+	 * just stash it, ->commit() submits the whole batch in one go
+	 */
+	ld->iocbs[ld->queued] = &io_u->iocb;
+	ld->io_us[ld->queued] = io_u;
+	ld->queued++;
+	return 0;
+}
+
+static int fio_libaio_commit(struct thread_data *td)
+{
+	struct libaio_data *ld = td->io_ops->data;
+	struct iocb **iocbs = ld->iocbs;
+	struct io_u **io_us = ld->io_us;
+	long ret;
+	int i;
+
+	while (ld->queued) {
+		ret = io_submit(ld->aio_ctx, ld->queued, iocbs);
+		if (ret > 0) {
+			ld->queued -= ret;
+			iocbs += ret;
+			io_us += ret;
+			continue;
+		} else if (ret == -EAGAIN || !ret)
 			usleep(100);
 		else if (ret == -EINTR)
 			continue;
 		else
 			break;
-	} while (1);
+	}
 
-	if (ret <= 0) {
-		io_u->resid = io_u->buflen;
-		io_u->error = -ret;
-		return 1;
+	if (!ld->queued)
+		return 0;
+
+	/*
+	 * fail whatever didn't make it to the kernel. no event will come
+	 * for those, so they are handed back by ->getevents().
+	 */
+	for (i = 0; i < ld->queued; i++) {
+		io_us[i]->resid = io_us[i]->buflen;
+		io_us[i]->error = -ret;
+		ld->failed[ld->nr_failed++] = io_us[i];
 	}
 
-	return 0;
+	ld->queued = 0;
+	return -ret;
 }
 
 static int fio_libaio_cancel(struct thread_data *td, struct io_u *io_u)
@@ -108,6 +159,9 @@ static void fio_libaio_cleanup(struct thread_data *td)
 		io_destroy(ld->aio_ctx);
 		if (ld->aio_events)
 			free(ld->aio_events);
+		free(ld->iocbs);
+		free(ld->io_us);
+		free(ld->failed);
 
 		free(ld);
 		td->io_ops->data = NULL;
@@ -127,6 +181,11 @@ static int fio_libaio_init(struct thread_data *td)
 
 	ld->aio_events = malloc(td->iodepth * sizeof(struct io_event));
 	memset(ld->aio_events, 0, td->iodepth * sizeof(struct io_event));
+	ld->iocbs = malloc(td->iodepth * sizeof(struct iocb *));
+	memset(ld->iocbs, 0, td->iodepth * sizeof(struct iocb *));
+	ld->io_us = malloc(td->iodepth * sizeof(struct io_u *));
+	memset(ld->io_us, 0, td->iodepth * sizeof(struct io_u *));
+	ld->failed = malloc(td->iodepth * sizeof(struct io_u *));
 	td->io_ops->data = ld;
 	return 0;
 }
@@ -137,6 +196,7 @@ static struct ioengine_ops ioengine = {
 	.init		= fio_libaio_init,
 	.prep		= fio_libaio_prep,
 	.queue		= fio_libaio_queue,
+	.commit		= fio_libaio_commit,
 	.cancel		= fio_libaio_cancel,
 	.getevents	= fio_libaio_getevents,
 	.event		= fio_libaio_event,
@@ -1,6 +1,10 @@
 /*
- * regular read/write sync io engine
+ * mmap io engine
  *
+ * ios are queued up to iodepth. Queueing an io asks the kernel to start
+ * reading in its pages, the copy to/from the mapping is done when the io
+ * is reaped. With a deeper queue, the prefetch runs further ahead of the
+ * copies and page faults are mostly avoided.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,69 +17,167 @@
 #include "../os.h"
 
 struct mmapio_data {
-	struct io_u *last_io_u;
+	struct io_u **io_us;
+	struct io_u **events;
+	unsigned int queued;
+	unsigned long page_mask;
 };
 
-static int fio_mmapio_getevents(struct thread_data *td, int fio_unused min,
-				int max, struct timespec fio_unused *t)
+static void fio_mmapio_copy(struct thread_data *td, void *dst, void *src,
+			    unsigned long len)
 {
-	assert(max <= 1);
+#ifdef ARCH_HAVE_NT_COPY
+	if (td->mmap_nontemporal) {
+		arch_memcpy_nt(dst, src, len);
+		return;
+	}
+#endif
+	memcpy(dst, src, len);
+}
 
-	/*
-	 * we can only have one finished io_u for sync io, since the depth
-	 * is always 1
-	 */
-	if (list_empty(&td->io_u_busylist))
+/*
+ * Only sync what was written since the last sync, not the whole file
+ */
+static int fio_mmapio_sync(struct mmapio_data *sd, struct fio_file *f)
+{
+	unsigned long long start, end;
+
+	if (f->mmap_dirty_end <= f->mmap_dirty_start)
 		return 0;
 
-	return 1;
+	start = f->mmap_dirty_start & ~sd->page_mask;
+	end = f->mmap_dirty_end;
+	f->mmap_dirty_start = f->mmap_dirty_end = 0;
+
+	if (msync(f->mmap + start, end - start, MS_SYNC) < 0)
+		return errno;
+
+	return 0;
 }
 
-static struct io_u *fio_mmapio_event(struct thread_data *td, int event)
+static void fio_mmapio_mark_dirty(struct fio_file *f,
+				  unsigned long long off, unsigned int len)
 {
-	struct mmapio_data *sd = td->io_ops->data;
-
-	assert(event == 0);
+	if (f->mmap_dirty_end <= f->mmap_dirty_start) {
+		f->mmap_dirty_start = off;
+		f->mmap_dirty_end = off + len;
+		return;
+	}
 
-	return sd->last_io_u;
+	if (off < f->mmap_dirty_start)
+		f->mmap_dirty_start = off;
+	if (off + len > f->mmap_dirty_end)
+		f->mmap_dirty_end = off + len;
 }
 
-
-static int fio_mmapio_queue(struct thread_data *td, struct io_u *io_u)
+static void fio_mmapio_do_io(struct thread_data *td, struct mmapio_data *sd,
+			     struct io_u *io_u)
 {
 	struct fio_file *f = io_u->file;
 	unsigned long long real_off = io_u->offset - f->file_offset;
-	struct mmapio_data *sd = td->io_ops->data;
+	unsigned long long start;
 
 	if (io_u->ddir == DDIR_READ)
-		memcpy(io_u->buf, f->mmap + real_off, io_u->buflen);
-	else if (io_u->ddir == DDIR_WRITE)
-		memcpy(f->mmap + real_off, io_u->buf, io_u->buflen);
-	else if (io_u->ddir == DDIR_SYNC) {
-		if (msync(f->mmap, f->file_size, MS_SYNC))
-			io_u->error = errno;
+		fio_mmapio_copy(td, io_u->buf, f->mmap + real_off, io_u->buflen);
+	else if (io_u->ddir == DDIR_WRITE) {
+		fio_mmapio_copy(td, f->mmap + real_off, io_u->buf, io_u->buflen);
+		fio_mmapio_mark_dirty(f, real_off, io_u->buflen);
+	} else if (io_u->ddir == DDIR_SYNC) {
+		io_u->error = fio_mmapio_sync(sd, f);
+		return;
 	}
 
 	/*
 	 * not really direct, but should drop the pages from the cache
 	 */
-	if (td->odirect && io_u->ddir != DDIR_SYNC) {
-		if (msync(f->mmap + real_off, io_u->buflen, MS_SYNC) < 0)
+	if (td->odirect) {
+		start = real_off & ~sd->page_mask;
+		if (msync(f->mmap + start, real_off + io_u->buflen - start, MS_SYNC) < 0)
 			io_u->error = errno;
-		if (madvise(f->mmap + real_off, io_u->buflen,  MADV_DONTNEED) < 0)
+		if (madvise(f->mmap + start, real_off + io_u->buflen - start, MADV_DONTNEED) < 0)
 			io_u->error = errno;
 	}
+}
+
+/*
+ * ios complete in the order they were queued. Only min of them are done
+ * per call, the rest stay queued so the prefetch keeps running iodepth ios
+ * ahead of the copies. Cleanup asks for all of them.
+ */
+static int fio_mmapio_getevents(struct thread_data *td, int min,
+				int max, struct timespec fio_unused *t)
+{
+	struct mmapio_data *sd = td->io_ops->data;
+	unsigned int i, nr = min;
+
+	if (min > max)
+		nr = max;
+	if (nr > sd->queued)
+		nr = sd->queued;
+
+	for (i = 0; i < nr; i++) {
+		sd->events[i] = sd->io_us[i];
+		fio_mmapio_do_io(td, sd, sd->events[i]);
+	}
 
-	if (!io_u->error)
-		sd->last_io_u = io_u;
+	sd->queued -= nr;
+	memmove(sd->io_us, sd->io_us + nr, sd->queued * sizeof(struct io_u *));
+	return nr;
+}
+
+static struct io_u *fio_mmapio_event(struct thread_data *td, int event)
+{
+	struct mmapio_data *sd = td->io_ops->data;
 
-	return io_u->error;
+	return sd->events[event];
+}
+
+static int fio_mmapio_queue(struct thread_data *td, struct io_u *io_u)
+{
+	struct mmapio_data *sd = td->io_ops->data;
+	struct fio_file *f = io_u->file;
+	unsigned long long real_off, start;
+
+	assert(sd->queued < td->iodepth);
+
+	/*
+	 * kick off read-ahead of the pages, it doesn't wait for the io
+	 */
+	if (io_u->ddir != DDIR_SYNC) {
+		real_off = io_u->offset - f->file_offset;
+		start = real_off & ~sd->page_mask;
+		madvise(f->mmap + start, real_off + io_u->buflen - start, MADV_WILLNEED);
+	}
+
+	sd->io_us[sd->queued++] = io_u;
+	return 0;
+}
+
+static int fio_mmapio_cancel(struct thread_data *td, struct io_u *io_u)
+{
+	struct mmapio_data *sd = td->io_ops->data;
+	unsigned int i;
+
+	for (i = 0; i < sd->queued; i++) {
+		if (sd->io_us[i] != io_u)
+			continue;
+
+		sd->queued--;
+		memmove(&sd->io_us[i], &sd->io_us[i + 1], (sd->queued - i) * sizeof(struct io_u *));
+		return 0;
+	}
+
+	return 1;
 }
 
 static void fio_mmapio_cleanup(struct thread_data *td)
 {
-	if (td->io_ops->data) {
-		free(td->io_ops->data);
+	struct mmapio_data *sd = td->io_ops->data;
+
+	if (sd) {
+		free(sd->io_us);
+		free(sd->events);
+		free(sd);
 		td->io_ops->data = NULL;
 	}
 }
@@ -84,7 +186,11 @@ static int fio_mmapio_init(struct thread_data *td)
 {
 	struct mmapio_data *sd = malloc(sizeof(*sd));
 
-	sd->last_io_u = NULL;
+	memset(sd, 0, sizeof(*sd));
+	sd->io_us = malloc(td->iodepth * sizeof(struct io_u *));
+	sd->events = malloc(td->iodepth * sizeof(struct io_u *));
+	sd->page_mask = getpagesize() - 1;
+
 	td->io_ops->data = sd;
 	return 0;
 }
@@ -96,8 +202,9 @@ static struct ioengine_ops ioengine = {
 	.queue		= fio_mmapio_queue,
 	.getevents	= fio_mmapio_getevents,
 	.event		= fio_mmapio_event,
+	.cancel		= fio_mmapio_cancel,
 	.cleanup	= fio_mmapio_cleanup,
-	.flags		= FIO_SYNCIO | FIO_MMAPIO,
+	.flags		= FIO_MMAPIO,
 };
 
 static void fio_init fio_mmapio_register(void)
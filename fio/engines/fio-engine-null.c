@@ -20,7 +20,7 @@ static int fio_null_getevents(struct thread_data *td, int fio_unused min,
 {
 	assert(max <= 1);
 
-	if (list_empty(&td->io_u_busylist))
+	if (!io_u_in_flight(td))
 		return 0;
 
 	return 1;
@@ -79,8 +79,9 @@ static int fio_posixaio_getevents(struct thread_data *td, int min, int max,
 				  struct timespec *t)
 {
 	struct posixaio_data *pd = td->io_ops->data;
-	struct list_head *entry;
+	struct io_u *io_u;
 	struct timespec start;
+	unsigned int i;
 	int r, have_timeout = 0;
 
 	if (t && !fill_timespec(&start))
@@ -88,8 +89,7 @@ static int fio_posixaio_getevents(struct thread_data *td, int min, int max,
 
 	r = 0;
 restart:
-	list_for_each(entry, &td->io_u_busylist) {
-		struct io_u *io_u = list_entry(entry, struct io_u, list);
+	for_each_busy_io_u(td, io_u, i) {
 		int err;
 
 		if (io_u->seen)
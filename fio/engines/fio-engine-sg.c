@@ -1,28 +1,80 @@
 /*
  * scsi generic sg v3 io engine
  *
+ * Commands are queued with write(2) of their sg_io_hdr to the sg character
+ * device, and reaped with read(2), so any number of them can be in flight
+ * from one job. A batch is written with a single writev(2), and reaped
+ * with a non blocking readv(2), waiting in poll(2) when there is nothing
+ * to reap yet. Block devices are driven through their sg node, looked up
+ * in sysfs. If they don't have one, the SG_IO ioctl is used, which does
+ * one command at the time.
+ *
+ * The sg driver allows SG_MAX_QUEUE commands in flight per open file, so
+ * for deeper queues the device is opened several times and the io_us are
+ * spread over those.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#include <dirent.h>
+#include <limits.h>
 #include <sys/poll.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 
 #include "../fio.h"
 #include "../os.h"
 
 #ifdef FIO_HAVE_SGIO
 
+#ifndef SG_MAX_QUEUE
+#define SG_MAX_QUEUE	16
+#endif
+
 struct sgio_cmd {
 	unsigned char cdb[10];
 	int nr;
 };
 
+struct sgio_file {
+	/*
+	 * fds[i] takes the io_us with index i * SG_MAX_QUEUE and up. If
+	 * the file has no sg node, there are none and SG_IO is used.
+	 */
+	int *fds;
+	unsigned int nr_fds;
+	unsigned int bs;
+};
+
 struct sgio_data {
 	struct sgio_cmd *cmds;
+	struct sgio_file *files;
+	int files_ready;
+
+	/*
+	 * queued, but not yet written
+	 */
+	struct io_u **pending;
+	unsigned int nr_pending;
+	struct iovec *iovecs;
+
+	/*
+	 * reaped headers are read in to hdrs, through hdr_iovecs. done
+	 * holds io_us that completed without being read back (SG_IO, or
+	 * failed writes).
+	 */
+	struct sg_io_hdr *hdrs;
+	struct iovec *hdr_iovecs;
+	unsigned int nr_inflight;
+	struct io_u **done;
+	unsigned int nr_done;
 	struct io_u **events;
-	unsigned int bs;
+
+	struct pollfd *pfds;
+	unsigned int nr_pfds;
 };
 
 static void sgio_hdr_init(struct sgio_data *sd, struct sg_io_hdr *hdr,
@@ -45,122 +97,316 @@ static void sgio_hdr_init(struct sgio_data *sd, struct sg_io_hdr *hdr,
 	}
 }
 
-static int fio_sgio_ioctl_getevents(struct thread_data *td, int fio_unused min,
-				    int max, struct timespec fio_unused *t)
+/*
+ * Move the result of a finished command over to its io_u
+ */
+static void sgio_hdr_end(struct io_u *io_u, struct sg_io_hdr *hdr)
 {
-	assert(max <= 1);
+	if ((hdr->info & SG_INFO_OK_MASK) == SG_INFO_OK)
+		return;
 
-	/*
-	 * we can only have one finished io_u for sync io, since the depth
-	 * is always 1
-	 */
-	if (list_empty(&td->io_u_busylist))
-		return 0;
+	io_u->resid = hdr->resid;
+	io_u->error = EIO;
+}
 
-	return 1;
+static int sgio_read_capacity(int fd, unsigned int *bs)
+{
+	struct sg_io_hdr hdr;
+	unsigned char cdb[10], buf[8];
+
+	memset(&hdr, 0, sizeof(hdr));
+	memset(cdb, 0, sizeof(cdb));
+	memset(buf, 0, sizeof(buf));
+
+	cdb[0] = 0x25;
+	hdr.interface_id = 'S';
+	hdr.cmdp = cdb;
+	hdr.cmd_len = sizeof(cdb);
+	hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+	hdr.dxferp = buf;
+	hdr.dxfer_len = sizeof(buf);
+
+	if (ioctl(fd, SG_IO, &hdr) < 0)
+		return errno;
+	if ((hdr.info & SG_INFO_OK_MASK) != SG_INFO_OK)
+		return EIO;
+
+	*bs = (buf[4] << 24) | (buf[5] << 16) | (buf[6] << 8) | buf[7];
+	return 0;
 }
 
+/*
+ * Find the sg node of a block device, eg /dev/sg2 for /dev/sdc
+ */
+static int sgio_find_node(const char *name, char *path)
+{
+	struct dirent *de;
+	struct stat st;
+	char dir[128];
+	DIR *d;
+	int ret = 1;
+
+	if (stat(name, &st) < 0 || !S_ISBLK(st.st_mode))
+		return 1;
+
+	sprintf(dir, "/sys/dev/block/%u:%u/device/scsi_generic", major(st.st_rdev), minor(st.st_rdev));
+	d = opendir(dir);
+	if (!d)
+		return 1;
+
+	while ((de = readdir(d)) != NULL) {
+		if (!strncmp(de->d_name, "sg", 2)) {
+			snprintf(path, PATH_MAX, "/dev/%s", de->d_name);
+			ret = 0;
+			break;
+		}
+	}
+
+	closedir(d);
+	return ret;
+}
 
-static int fio_sgio_getevents(struct thread_data *td, int min, int max,
-			      struct timespec fio_unused *t)
+static int sgio_open_file(struct thread_data *td, struct fio_file *f,
+			  struct sgio_file *sf)
 {
-	struct fio_file *f = &td->files[0];
-	struct sgio_data *sd = td->io_ops->data;
-	struct pollfd pfd = { .fd = f->fd, .events = POLLIN };
-	void *buf = malloc(max * sizeof(struct sg_io_hdr));
-	int left = max, ret, events, i, r = 0, fl = 0;
+	const char *name = f->file_name;
+	char path[PATH_MAX];
+	unsigned int i;
+	int version;
 
-	/*
-	 * don't block for !events
-	 */
-	if (!min) {
-		fl = fcntl(f->fd, F_GETFL);
-		fcntl(f->fd, F_SETFL, fl | O_NONBLOCK);
+	if (td->filetype == FIO_TYPE_BD) {
+		if (ioctl(f->fd, BLKSSZGET, &sf->bs) < 0)
+			return errno;
+		if (sgio_find_node(f->file_name, path)) {
+			log_err("fio: %s has no sg node, using SG_IO\n", f->file_name);
+			return 0;
+		}
+		name = path;
+	} else {
+		if (ioctl(f->fd, SG_GET_VERSION_NUM, &version) < 0)
+			return errno;
+		if (sgio_read_capacity(f->fd, &sf->bs))
+			return EIO;
 	}
 
-	while (left) {
-		do {
-			if (!min)
-				break;
-			poll(&pfd, 1, -1);
-			if (pfd.revents & POLLIN)
-				break;
-		} while (1);
+	sf->nr_fds = (td->io_u_nr + SG_MAX_QUEUE - 1) / SG_MAX_QUEUE;
+	sf->fds = malloc(sf->nr_fds * sizeof(int));
+	for (i = 0; i < sf->nr_fds; i++) {
+		sf->fds[i] = open(name, O_RDWR | O_NONBLOCK);
+		if (sf->fds[i] < 0) {
+			sf->nr_fds = i;
+			return errno;
+		}
+	}
 
-		ret = read(f->fd, buf, left * sizeof(struct sg_io_hdr));
-		if (ret < 0) {
-			if (errno == EAGAIN)
-				break;
-			td_verror(td, errno);
-			r = -1;
-			break;
-		} else if (!ret)
-			break;
+	return 0;
+}
 
-		events = ret / sizeof(struct sg_io_hdr);
-		left -= events;
-		r += events;
+/*
+ * This can't be done from ->init(), the files aren't open until after the
+ * engine has been set up
+ */
+static int sgio_setup_files(struct thread_data *td)
+{
+	struct sgio_data *sd = td->io_ops->data;
+	struct sgio_file *sf;
+	struct fio_file *f;
+	unsigned int j, nr;
+	int i, ret;
+
+	nr = 0;
+	for_each_file(td, f, i) {
+		sf = &sd->files[i];
+
+		ret = sgio_open_file(td, f, sf);
+		if (ret) {
+			td_verror(td, ret);
+			return 1;
+		}
+		if (!sf->bs || (sf->bs & (sf->bs - 1))) {
+			log_err("fio: %s: bad block size %u\n", f->file_name, sf->bs);
+			td_verror(td, EINVAL);
+			return 1;
+		}
+		nr += sf->nr_fds;
+	}
 
-		for (i = 0; i < events; i++) {
-			struct sg_io_hdr *hdr = (struct sg_io_hdr *) buf + i;
+	sd->pfds = malloc(nr * sizeof(struct pollfd));
+	for_each_file(td, f, i) {
+		sf = &sd->files[i];
 
-			sd->events[i] = hdr->usr_ptr;
+		for (j = 0; j < sf->nr_fds; j++) {
+			sd->pfds[sd->nr_pfds].fd = sf->fds[j];
+			sd->pfds[sd->nr_pfds].events = POLLIN;
+			sd->nr_pfds++;
 		}
 	}
 
-	if (!min)
-		fcntl(f->fd, F_SETFL, fl);
+	sd->files_ready = 1;
+	return 0;
+}
+
+static struct sgio_file *sgio_file(struct thread_data *td, struct io_u *io_u)
+{
+	struct sgio_data *sd = td->io_ops->data;
+
+	return &sd->files[io_u->file - td->files];
+}
+
+static int sgio_fd(struct thread_data *td, struct io_u *io_u)
+{
+	struct sgio_file *sf = sgio_file(td, io_u);
+
+	if (!sf->nr_fds)
+		return -1;
 
-	free(buf);
-	return r;
+	return sf->fds[io_u->index / SG_MAX_QUEUE];
 }
 
-static int fio_sgio_ioctl_doio(struct thread_data *td,
-			       struct fio_file *f, struct io_u *io_u)
+/*
+ * Read back finished commands in to events[nr] and up, returns the new
+ * total
+ */
+static int fio_sgio_reap(struct thread_data *td, int nr, int max)
 {
 	struct sgio_data *sd = td->io_ops->data;
-	struct sg_io_hdr *hdr = &io_u->hdr;
+	struct sg_io_hdr *hdr;
+	struct io_u *io_u;
+	unsigned int i;
+	int ret, j, got;
+
+	while (sd->nr_done && nr < max)
+		sd->events[nr++] = sd->done[--sd->nr_done];
+
+	for (i = 0; i < sd->nr_pfds && nr < max; i++) {
+		ret = readv(sd->pfds[i].fd, &sd->hdr_iovecs[nr], max - nr);
+		if (ret < 0) {
+			if (errno == EAGAIN)
+				continue;
+			td_verror(td, errno);
+			return -1;
+		}
 
-	sd->events[0] = io_u;
+		got = ret / sizeof(struct sg_io_hdr);
+		sd->nr_inflight -= got;
+		for (j = 0; j < got; j++) {
+			hdr = &sd->hdrs[nr];
+			io_u = hdr->usr_ptr;
+			sgio_hdr_end(io_u, hdr);
+			sd->events[nr++] = io_u;
+		}
+	}
 
-	return ioctl(f->fd, SG_IO, hdr);
+	return nr;
 }
 
-static int fio_sgio_rw_doio(struct fio_file *f, struct io_u *io_u, int sync)
+/*
+ * Write the pending commands, one writev(2) per sg file. A command that
+ * can't be written is completed with the error.
+ */
+static int fio_sgio_commit(struct thread_data *td)
 {
-	struct sg_io_hdr *hdr = &io_u->hdr;
-	int ret;
+	struct sgio_data *sd = td->io_ops->data;
+	struct io_u *io_u;
+	unsigned int i, j, nr;
+	struct iovec *iov;
+	int fd, ret, err;
+
+	while (sd->nr_pending) {
+		fd = sgio_fd(td, sd->pending[0]);
+
+		nr = 0;
+		for (i = j = 0; i < sd->nr_pending; i++) {
+			io_u = sd->pending[i];
+			if (sgio_fd(td, io_u) != fd) {
+				sd->pending[j++] = io_u;
+				continue;
+			}
+
+			iov = &sd->iovecs[nr];
+			iov->iov_base = &io_u->hdr;
+			iov->iov_len = sizeof(struct sg_io_hdr);
+			sd->events[nr++] = io_u;
+		}
+		sd->nr_pending = j;
 
-	ret = write(f->fd, hdr, sizeof(*hdr));
-	if (ret < 0)
-		return errno;
+		/*
+		 * a short write stops at the command that failed
+		 */
+		ret = writev(fd, sd->iovecs, nr);
+		err = EIO;
+		if (ret < 0) {
+			err = errno;
+			ret = 0;
+		}
 
-	if (sync) {
-		ret = read(f->fd, hdr, sizeof(*hdr));
-		if (ret < 0)
-			return errno;
+		i = ret / sizeof(struct sg_io_hdr);
+		sd->nr_inflight += i;
+		for (; i < nr; i++) {
+			io_u = sd->events[i];
+			io_u->error = err;
+			sd->done[sd->nr_done++] = io_u;
+		}
 	}
 
 	return 0;
 }
 
-static int fio_sgio_doio(struct thread_data *td, struct io_u *io_u, int sync)
+/*
+ * Wait for at least min events, or until t has passed if given. The rate
+ * and iolog replay code wait for their next arrival this way.
+ */
+static int fio_sgio_getevents(struct thread_data *td, int min, int max,
+			      struct timespec *t)
 {
-	struct fio_file *f = io_u->file;
+	struct sgio_data *sd = td->io_ops->data;
+	unsigned long long timeout = 0, spent;
+	struct timespec start, left, *tp = NULL;
+	int nr = 0;
+
+	if (sd->nr_pending)
+		fio_sgio_commit(td);
+
+	if (t) {
+		timeout = t->tv_sec * 1000000000ULL + t->tv_nsec;
+		fio_gettime(&start, NULL);
+		tp = &left;
+	}
+
+	while (1) {
+		nr = fio_sgio_reap(td, nr, max);
+		if (nr < 0 || nr >= min || nr == max || !sd->nr_inflight)
+			break;
 
-	if (td->filetype == FIO_TYPE_BD)
-		return fio_sgio_ioctl_doio(td, f, io_u);
+		if (t) {
+			spent = ntime_since_now(&start);
+			if (spent >= timeout)
+				break;
+			left.tv_sec = (timeout - spent) / 1000000000ULL;
+			left.tv_nsec = (timeout - spent) % 1000000000ULL;
+		}
+
+		if (ppoll(sd->pfds, sd->nr_pfds, tp, NULL) < 0 && errno != EINTR) {
+			td_verror(td, errno);
+			return -1;
+		}
+	}
 
-	return fio_sgio_rw_doio(f, io_u, sync);
+	return nr;
 }
 
 static int fio_sgio_prep(struct thread_data *td, struct io_u *io_u)
 {
 	struct sg_io_hdr *hdr = &io_u->hdr;
 	struct sgio_data *sd = td->io_ops->data;
+	struct sgio_file *sf;
 	int nr_blocks, lba;
 
-	if (io_u->buflen & (sd->bs - 1)) {
+	if (!sd->files_ready && sgio_setup_files(td))
+		return 1;
+
+	sf = sgio_file(td, io_u);
+	if (io_u->buflen & (sf->bs - 1)) {
 		log_err("read/write not sector aligned\n");
 		return EINVAL;
 	}
@@ -183,8 +429,8 @@ static int fio_sgio_prep(struct thread_data *td, struct io_u *io_u)
 	}
 
 	if (hdr->dxfer_direction != SG_DXFER_NONE) {
-		nr_blocks = io_u->buflen / sd->bs;
-		lba = io_u->offset / sd->bs;
+		nr_blocks = io_u->buflen / sf->bs;
+		lba = io_u->offset / sf->bs;
 		hdr->cmdp[2] = (unsigned char) ((lba >> 24) & 0xff);
 		hdr->cmdp[3] = (unsigned char) ((lba >> 16) & 0xff);
 		hdr->cmdp[4] = (unsigned char) ((lba >>  8) & 0xff);
@@ -198,19 +444,25 @@ static int fio_sgio_prep(struct thread_data *td, struct io_u *io_u)
 
 static int fio_sgio_queue(struct thread_data *td, struct io_u *io_u)
 {
+	struct sgio_data *sd = td->io_ops->data;
 	struct sg_io_hdr *hdr = &io_u->hdr;
-	int ret;
 
-	ret = fio_sgio_doio(td, io_u, io_u->ddir == DDIR_SYNC);
+	if (sgio_fd(td, io_u) != -1) {
+		sd->pending[sd->nr_pending++] = io_u;
+		return 0;
+	}
 
-	if (ret < 0)
+	/*
+	 * no sg node, the command is done by the time the ioctl returns
+	 */
+	if (ioctl(io_u->file->fd, SG_IO, hdr) < 0) {
 		io_u->error = errno;
-	else if (hdr->status) {
-		io_u->resid = hdr->resid;
-		io_u->error = EIO;
+		return io_u->error;
 	}
 
-	return io_u->error;
+	sgio_hdr_end(io_u, hdr);
+	sd->done[sd->nr_done++] = io_u;
+	return 0;
 }
 
 static struct io_u *fio_sgio_event(struct thread_data *td, int event)
@@ -220,98 +472,74 @@ static struct io_u *fio_sgio_event(struct thread_data *td, int event)
 	return sd->events[event];
 }
 
-static int fio_sgio_get_bs(struct thread_data *td, unsigned int *bs)
+static void fio_sgio_cleanup(struct thread_data *td)
 {
 	struct sgio_data *sd = td->io_ops->data;
-	struct io_u *io_u;
-	struct sg_io_hdr *hdr;
-	unsigned char buf[8];
-	int ret;
-
-	io_u = __get_io_u(td);
-	assert(io_u);
-
-	hdr = &io_u->hdr;
-	sgio_hdr_init(sd, hdr, io_u, 0);
-	memset(buf, 0, sizeof(buf));
+	unsigned int i, j;
 
-	hdr->cmdp[0] = 0x25;
-	hdr->dxfer_direction = SG_DXFER_FROM_DEV;
-	hdr->dxferp = buf;
-	hdr->dxfer_len = sizeof(buf);
+	if (!sd)
+		return;
 
-	ret = fio_sgio_doio(td, io_u, 1);
-	if (ret) {
-		put_io_u(td, io_u);
-		return ret;
+	if (sd->files) {
+		for (i = 0; i < td->nr_files; i++) {
+			for (j = 0; j < sd->files[i].nr_fds; j++)
+				close(sd->files[i].fds[j]);
+			free(sd->files[i].fds);
+		}
 	}
 
-	*bs = (buf[4] << 24) | (buf[5] << 16) | (buf[6] << 8) | buf[7];
-	put_io_u(td, io_u);
-	return 0;
-}
-
-static void fio_sgio_cleanup(struct thread_data *td)
-{
-	if (td->io_ops->data) {
-		free(td->io_ops->data);
-		td->io_ops->data = NULL;
-	}
+	free(sd->files);
+	free(sd->cmds);
+	free(sd->pending);
+	free(sd->iovecs);
+	free(sd->hdrs);
+	free(sd->hdr_iovecs);
+	free(sd->done);
+	free(sd->events);
+	free(sd->pfds);
+	free(sd);
+	td->io_ops->data = NULL;
 }
 
 static int fio_sgio_init(struct thread_data *td)
 {
-	struct fio_file *f = &td->files[0];
 	struct sgio_data *sd;
-	unsigned int bs;
-	int ret;
+	unsigned int i, depth = td->io_u_nr;
+
+	if (td->filetype != FIO_TYPE_BD && td->filetype != FIO_TYPE_CHAR) {
+		log_err("ioengine sgio only works on block devices\n");
+		return 1;
+	}
 
 	sd = malloc(sizeof(*sd));
 	memset(sd, 0, sizeof(*sd));
-	sd->cmds = malloc(td->iodepth * sizeof(struct sgio_cmd));
-	memset(sd->cmds, 0, td->iodepth * sizeof(struct sgio_cmd));
-	sd->events = malloc(td->iodepth * sizeof(struct io_u *));
-	memset(sd->events, 0, td->iodepth * sizeof(struct io_u *));
 	td->io_ops->data = sd;
 
-	if (td->filetype == FIO_TYPE_BD) {
-		if (ioctl(f->fd, BLKSSZGET, &bs) < 0) {
-			td_verror(td, errno);
-			goto err;
-		}
-	} else if (td->filetype == FIO_TYPE_CHAR) {
-		int version;
-
-		if (ioctl(f->fd, SG_GET_VERSION_NUM, &version) < 0) {
-			td_verror(td, errno);
-			goto err;
-		}
-
-		ret = fio_sgio_get_bs(td, &bs);
-		if (ret)
-			goto err;
-	} else {
-		log_err("ioengine sgio only works on block devices\n");
-		goto err;
+	sd->cmds = calloc(depth, sizeof(struct sgio_cmd));
+	sd->files = calloc(td->nr_files, sizeof(struct sgio_file));
+	sd->pending = malloc(depth * sizeof(struct io_u *));
+	sd->iovecs = malloc(depth * sizeof(struct iovec));
+	sd->hdrs = malloc(depth * sizeof(struct sg_io_hdr));
+	sd->hdr_iovecs = malloc(depth * sizeof(struct iovec));
+	sd->done = malloc(depth * sizeof(struct io_u *));
+	sd->events = malloc(depth * sizeof(struct io_u *));
+	if (!sd->cmds || !sd->files || !sd->pending || !sd->iovecs ||
+	    !sd->hdrs || !sd->hdr_iovecs || !sd->done || !sd->events) {
+		fio_sgio_cleanup(td);
+		td_verror(td, ENOMEM);
+		return 1;
 	}
 
-	sd->bs = bs;
-
-	if (td->filetype == FIO_TYPE_BD)
-		td->io_ops->getevents = fio_sgio_ioctl_getevents;
-	else
-		td->io_ops->getevents = fio_sgio_getevents;
+	for (i = 0; i < depth; i++) {
+		sd->hdr_iovecs[i].iov_base = &sd->hdrs[i];
+		sd->hdr_iovecs[i].iov_len = sizeof(struct sg_io_hdr);
+	}
 
 	/*
 	 * we want to do it, regardless of whether odirect is set or not
 	 */
 	td->override_sync = 1;
 	return 0;
-err:
-	free(sd->events);
-	free(sd->cmds);
-	free(sd);
-	return 1;
 }
 
 static struct ioengine_ops ioengine = {
@@ -320,10 +548,11 @@ static struct ioengine_ops ioengine = {
 	.init		= fio_sgio_init,
 	.prep		= fio_sgio_prep,
 	.queue		= fio_sgio_queue,
+	.commit		= fio_sgio_commit,
 	.getevents	= fio_sgio_getevents,
 	.event		= fio_sgio_event,
 	.cleanup	= fio_sgio_cleanup,
-	.flags		= FIO_SYNCIO | FIO_RAWIO,
+	.flags		= FIO_RAWIO,
 };
 
 #else /* FIO_HAVE_SGIO */
@@ -63,6 +63,17 @@ static int fio_skeleton_queue(struct thread_data *td, struct io_u *io_u)
 	return 0;
 }
 
+/*
+ * The ->commit() hook is called by the core once it has queued a batch of
+ * io_u's with ->queue(), and should submit anything the io engine held on
+ * to. This allows an engine to submit a whole batch of io with a single
+ * system call. Returns 0 on success or an error value. Not required.
+ */
+static int fio_skeleton_commit(struct thread_data *td)
+{
+	return 0;
+}
+
 /*
  * The ->prep() function is called for each io_u prior to being submitted
  * with ->queue(). This hook allows the io engine to perform any
@@ -102,6 +113,7 @@ struct ioengine_ops ioengine = {
 	.init		= fio_skeleton_init,
 	.prep		= fio_skeleton_prep,
 	.queue		= fio_skeleton_queue,
+	.commit		= fio_skeleton_commit,
 	.cancel		= fio_skeleton_cancel,
 	.getevents	= fio_skeleton_getevents,
 	.event		= fio_skeleton_event,
@@ -7,7 +7,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
-#include <sys/poll.h>
+#include <fcntl.h>
 
 #include "../fio.h"
 #include "../os.h"
@@ -17,6 +17,10 @@
 struct spliceio_data {
 	struct io_u *last_io_u;
 	int pipe[2];
+	int pipe_size;
+	int null_fd;
+	int page_mask;
+	int gift;
 };
 
 static int fio_spliceio_getevents(struct thread_data *td, int fio_unused min,
@@ -28,7 +32,7 @@ static int fio_spliceio_getevents(struct thread_data *td, int fio_unused min,
 	 * we can only have one finished io_u for sync io, since the depth
 	 * is always 1
 	 */
-	if (list_empty(&td->io_u_busylist))
+	if (!io_u_in_flight(td))
 		return 0;
 
 	return 1;
@@ -44,15 +48,46 @@ static struct io_u *fio_spliceio_event(struct thread_data *td, int event)
 }
 
 /*
- * For splice reading, we unfortunately cannot (yet) vmsplice the other way.
- * So just splice the data from the file into the pipe, and use regular
- * read to fill the buffer. Doesn't make a lot of sense, but...
+ * Drain the pipe. If the data isn't going to be looked at, the pages are
+ * spliced on to /dev/null so they are never copied to user space.
+ * Otherwise vmsplice them into the io_u buffer.
+ */
+static int splice_drain(struct thread_data *td, struct spliceio_data *sd,
+			void *p, int len)
+{
+	struct iovec iov;
+	int ret;
+
+	while (len) {
+		if (td->verify == VERIFY_NONE)
+			ret = splice(sd->pipe[0], NULL, sd->null_fd, NULL, len, SPLICE_F_MOVE);
+		else {
+			iov.iov_base = p;
+			iov.iov_len = len;
+			ret = vmsplice(sd->pipe[0], &iov, 1, 0);
+		}
+
+		if (ret < 0)
+			return errno;
+		else if (!ret)
+			return EIO;
+
+		len -= ret;
+		p += ret;
+	}
+
+	return 0;
+}
+
+/*
+ * For splice reading, splice the data from the file into the pipe, then
+ * drain it again. Each pass moves as much as the pipe holds.
  */
 static int fio_splice_read(struct thread_data *td, struct io_u *io_u)
 {
 	struct spliceio_data *sd = td->io_ops->data;
 	struct fio_file *f = io_u->file;
-	int ret, ret2, buflen;
+	int ret, err, buflen;
 	off_t offset;
 	void *p;
 
@@ -62,35 +97,35 @@ static int fio_splice_read(struct thread_data *td, struct io_u *io_u)
 	while (buflen) {
 		int this_len = buflen;
 
-		if (this_len > SPLICE_DEF_SIZE)
-			this_len = SPLICE_DEF_SIZE;
+		if (this_len > sd->pipe_size)
+			this_len = sd->pipe_size;
 
-		ret = splice(f->fd, &offset, sd->pipe[1], NULL, this_len, SPLICE_F_MORE);
+		ret = splice(f->fd, &offset, sd->pipe[1], NULL, this_len, SPLICE_F_MORE | SPLICE_F_MOVE);
 		if (ret < 0) {
 			if (errno == ENODATA || errno == EAGAIN)
 				continue;
 
-			return errno;
+			return -1;
+		} else if (!ret)
+			break;
+
+		err = splice_drain(td, sd, p, ret);
+		if (err) {
+			errno = err;
+			return -1;
 		}
 
 		buflen -= ret;
-
-		while (ret) {
-			ret2 = read(sd->pipe[0], p, ret);
-			if (ret2 < 0)
-				return errno;
-
-			ret -= ret2;
-			p += ret2;
-		}
+		p += ret;
 	}
 
-	return io_u->buflen;
+	return io_u->buflen - buflen;
 }
 
 /*
  * For splice writing, we can vmsplice our data buffer directly into a
- * pipe and then splice that to a file.
+ * pipe and then splice that to a file. Page aligned buffers are gifted, so
+ * the kernel may move the pages instead of copying them.
  */
 static int fio_splice_write(struct thread_data *td, struct io_u *io_u)
 {
@@ -101,26 +136,32 @@ static int fio_splice_write(struct thread_data *td, struct io_u *io_u)
 			.iov_len = io_u->buflen,
 		}
 	};
-	struct pollfd pfd = { .fd = sd->pipe[1], .events = POLLOUT, };
 	struct fio_file *f = io_u->file;
 	off_t off = io_u->offset;
+	unsigned int flags = 0;
 	int ret, ret2;
 
+	if (sd->gift && !((unsigned long) io_u->buf & sd->page_mask) &&
+	    !(io_u->buflen & sd->page_mask))
+		flags = SPLICE_F_GIFT;
+
 	while (iov[0].iov_len) {
-		if (poll(&pfd, 1, -1) < 0)
-			return errno;
+		struct iovec this_iov = iov[0];
+
+		if (this_iov.iov_len > (unsigned int) sd->pipe_size)
+			this_iov.iov_len = sd->pipe_size;
 
-		ret = vmsplice(sd->pipe[1], iov, 1, SPLICE_F_NONBLOCK);
+		ret = vmsplice(sd->pipe[1], &this_iov, 1, flags);
 		if (ret < 0)
-			return errno;
+			return -1;
 
 		iov[0].iov_len -= ret;
 		iov[0].iov_base += ret;
 
 		while (ret) {
-			ret2 = splice(sd->pipe[0], NULL, f->fd, &off, ret, 0);
+			ret2 = splice(sd->pipe[0], NULL, f->fd, &off, ret, SPLICE_F_MOVE);
 			if (ret2 < 0)
-				return errno;
+				return -1;
 
 			ret -= ret2;
 		}
@@ -132,7 +173,7 @@ static int fio_splice_write(struct thread_data *td, struct io_u *io_u)
 static int fio_spliceio_queue(struct thread_data *td, struct io_u *io_u)
 {
 	struct spliceio_data *sd = td->io_ops->data;
-	unsigned int ret;
+	int ret;
 
 	if (io_u->ddir == DDIR_READ)
 		ret = fio_splice_read(td, io_u);
@@ -141,8 +182,8 @@ static int fio_spliceio_queue(struct thread_data *td, struct io_u *io_u)
 	else
 		ret = fsync(io_u->file->fd);
 
-	if (ret != io_u->buflen) {
-		if (ret > 0) {
+	if (ret != (int) io_u->buflen) {
+		if (ret >= 0) {
 			io_u->resid = io_u->buflen - ret;
 			io_u->error = ENODATA;
 		} else
@@ -162,22 +203,60 @@ static void fio_spliceio_cleanup(struct thread_data *td)
 	if (sd) {
 		close(sd->pipe[0]);
 		close(sd->pipe[1]);
+		close(sd->null_fd);
 		free(sd);
 		td->io_ops->data = NULL;
 	}
 }
 
+/*
+ * The pipe is kept for the life of the job. Grow it to hold a full block
+ * if the kernel lets us, so each io is one splice in and one out.
+ */
+static void fio_splice_size_pipe(struct thread_data *td,
+				 struct spliceio_data *sd)
+{
+	int size = max(td->max_bs[DDIR_READ], td->max_bs[DDIR_WRITE]);
+
+	sd->pipe_size = SPLICE_DEF_SIZE;
+
+	if (size > SPLICE_DEF_SIZE && fcntl(sd->pipe[1], F_SETPIPE_SZ, size) < 0)
+		return;
+
+	size = fcntl(sd->pipe[1], F_GETPIPE_SZ);
+	if (size > 0)
+		sd->pipe_size = size;
+}
+
 static int fio_spliceio_init(struct thread_data *td)
 {
 	struct spliceio_data *sd = malloc(sizeof(*sd));
 
 	sd->last_io_u = NULL;
+	sd->page_mask = getpagesize() - 1;
+
+	/*
+	 * gifted pages must not be touched again, and with verify or
+	 * refill_buffers the buffer is rewritten for the next io
+	 */
+	sd->gift = td->verify == VERIFY_NONE && !td->refill_buffers;
+
+	sd->null_fd = open("/dev/null", O_WRONLY);
+	if (sd->null_fd < 0) {
+		td_verror(td, errno);
+		free(sd);
+		return 1;
+	}
+
 	if (pipe(sd->pipe) < 0) {
 		td_verror(td, errno);
+		close(sd->null_fd);
 		free(sd);
 		return 1;
 	}
 
+	fio_splice_size_pipe(td, sd);
+
 	td->io_ops->data = sd;
 	return 0;
 }
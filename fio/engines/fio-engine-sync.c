@@ -1,18 +1,47 @@
 /*
- * regular read/write sync io engine
+ * regular read/write sync io engines
  *
+ * sync		read(2)/write(2), with an lseek(2) if the io isn't sequential
+ * psync	pread(2)/pwrite(2), one system call per io
+ * pvsync	io_us that follow each other on the file are merged and done
+ *		with a single preadv(2)/pwritev(2)
+ * pvsync2	as pvsync, with preadv2(2)/pwritev2(2) so the hipri and
+ *		nowait flags can be passed
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#include <limits.h>
+#include <sys/uio.h>
 
 #include "../fio.h"
 #include "../os.h"
 
+#ifndef IOV_MAX
+#define IOV_MAX		1024
+#endif
+
 struct syncio_data {
 	struct io_u *last_io_u;
+
+	/*
+	 * for the vectored engines. the current vector of io_us that
+	 * follow each other, and the ones that are done.
+	 */
+	struct iovec *iovecs;
+	struct io_u **io_us;
+	unsigned int queued;
+	unsigned int max_queued;
+	unsigned long long next_offset;
+
+	struct io_u **done;
+	unsigned int nr_done;
+	struct io_u **events;
+
+	int rwf_flags;
+	int pv2;
 };
 
 static int fio_syncio_getevents(struct thread_data *td, int fio_unused min,
@@ -24,7 +53,7 @@ static int fio_syncio_getevents(struct thread_data *td, int fio_unused min,
 	 * we can only have one finished io_u for sync io, since the depth
 	 * is always 1
 	 */
-	if (list_empty(&td->io_u_busylist))
+	if (!io_u_in_flight(td))
 		return 0;
 
 	return 1;
@@ -56,26 +85,58 @@ static int fio_syncio_prep(struct thread_data *td, struct io_u *io_u)
 	return 0;
 }
 
+/*
+ * Set the error and residual of an io_u that got ret of its buflen done
+ */
+static void fio_syncio_end(struct io_u *io_u, long ret)
+{
+	if (ret == (long) io_u->buflen)
+		return;
+
+	if (ret > 0) {
+		io_u->resid = io_u->buflen - ret;
+		io_u->error = EIO;
+	} else if (ret < 0)
+		io_u->error = errno;
+	else
+		io_u->error = EIO;
+}
+
 static int fio_syncio_queue(struct thread_data *td, struct io_u *io_u)
 {
 	struct syncio_data *sd = td->io_ops->data;
 	struct fio_file *f = io_u->file;
-	unsigned int ret;
+	long ret;
 
 	if (io_u->ddir == DDIR_READ)
 		ret = read(f->fd, io_u->buf, io_u->buflen);
 	else if (io_u->ddir == DDIR_WRITE)
 		ret = write(f->fd, io_u->buf, io_u->buflen);
 	else
-		ret = fsync(f->fd);
+		ret = fsync(f->fd) ? -1 : (long) io_u->buflen;
 
-	if (ret != io_u->buflen) {
-		if (ret > 0) {
-			io_u->resid = io_u->buflen - ret;
-			io_u->error = EIO;
-		} else
-			io_u->error = errno;
-	}
+	fio_syncio_end(io_u, ret);
+
+	if (!io_u->error)
+		sd->last_io_u = io_u;
+
+	return io_u->error;
+}
+
+static int fio_psyncio_queue(struct thread_data *td, struct io_u *io_u)
+{
+	struct syncio_data *sd = td->io_ops->data;
+	struct fio_file *f = io_u->file;
+	long ret;
+
+	if (io_u->ddir == DDIR_READ)
+		ret = pread(f->fd, io_u->buf, io_u->buflen, io_u->offset);
+	else if (io_u->ddir == DDIR_WRITE)
+		ret = pwrite(f->fd, io_u->buf, io_u->buflen, io_u->offset);
+	else
+		ret = fsync(f->fd) ? -1 : (long) io_u->buflen;
+
+	fio_syncio_end(io_u, ret);
 
 	if (!io_u->error)
 		sd->last_io_u = io_u;
@@ -83,10 +144,143 @@ static int fio_syncio_queue(struct thread_data *td, struct io_u *io_u)
 	return io_u->error;
 }
 
+static long fio_pvsyncio_rw(struct syncio_data *sd, struct io_u *first,
+			    unsigned int nr)
+{
+	int fd = first->file->fd;
+
+#ifdef FIO_HAVE_PWRITEV2
+	if (sd->pv2) {
+		long ret;
+
+		if (first->ddir == DDIR_READ)
+			ret = fio_preadv2(fd, sd->iovecs, nr, first->offset, sd->rwf_flags);
+		else
+			ret = fio_pwritev2(fd, sd->iovecs, nr, first->offset, sd->rwf_flags);
+
+		/*
+		 * with nowait, io that has to block isn't an error. it's
+		 * just done the slow way.
+		 */
+		if (ret >= 0 || errno != EAGAIN || !(sd->rwf_flags & RWF_NOWAIT))
+			return ret;
+		if (first->ddir == DDIR_READ)
+			return fio_preadv2(fd, sd->iovecs, nr, first->offset, sd->rwf_flags & ~RWF_NOWAIT);
+
+		return fio_pwritev2(fd, sd->iovecs, nr, first->offset, sd->rwf_flags & ~RWF_NOWAIT);
+	}
+#endif
+
+	if (first->ddir == DDIR_READ)
+		return preadv(fd, sd->iovecs, nr, first->offset);
+
+	return pwritev(fd, sd->iovecs, nr, first->offset);
+}
+
+/*
+ * Issue the current vector, and spread the result over its io_us
+ */
+static void fio_pvsyncio_flush(struct syncio_data *sd)
+{
+	unsigned int i;
+	long ret;
+
+	if (!sd->queued)
+		return;
+
+	ret = fio_pvsyncio_rw(sd, sd->io_us[0], sd->queued);
+
+	for (i = 0; i < sd->queued; i++) {
+		struct io_u *io_u = sd->io_us[i];
+
+		if (ret < 0)
+			fio_syncio_end(io_u, ret);
+		else if ((unsigned long) ret >= io_u->buflen) {
+			ret -= io_u->buflen;
+		} else {
+			fio_syncio_end(io_u, ret);
+			ret = 0;
+		}
+
+		sd->done[sd->nr_done++] = io_u;
+	}
+
+	sd->queued = 0;
+}
+
+static int fio_pvsyncio_queue(struct thread_data *td, struct io_u *io_u)
+{
+	struct syncio_data *sd = td->io_ops->data;
+	struct io_u *first = sd->io_us[0];
+
+	/*
+	 * start a new vector, unless this io_u follows the current one
+	 */
+	if (sd->queued && (io_u->file != first->file ||
+	    io_u->ddir != first->ddir || io_u->offset != sd->next_offset ||
+	    sd->queued == sd->max_queued))
+		fio_pvsyncio_flush(sd);
+
+	if (io_u->ddir == DDIR_SYNC) {
+		fio_pvsyncio_flush(sd);
+		if (fsync(io_u->file->fd) < 0)
+			io_u->error = errno;
+		sd->done[sd->nr_done++] = io_u;
+		return 0;
+	}
+
+	sd->iovecs[sd->queued].iov_base = io_u->buf;
+	sd->iovecs[sd->queued].iov_len = io_u->buflen;
+	sd->io_us[sd->queued++] = io_u;
+	sd->next_offset = io_u->offset + io_u->buflen;
+	return 0;
+}
+
+static int fio_pvsyncio_commit(struct thread_data *td)
+{
+	fio_pvsyncio_flush(td->io_ops->data);
+	return 0;
+}
+
+/*
+ * The io is done by the time it's committed, so there's never anything to
+ * wait for
+ */
+static int fio_pvsyncio_getevents(struct thread_data *td, int fio_unused min,
+				  int max, struct timespec fio_unused *t)
+{
+	struct syncio_data *sd = td->io_ops->data;
+	unsigned int nr;
+
+	fio_pvsyncio_flush(sd);
+
+	nr = sd->nr_done;
+	if (nr > (unsigned int) max)
+		nr = max;
+
+	memcpy(sd->events, sd->done, nr * sizeof(struct io_u *));
+	sd->nr_done -= nr;
+	memmove(sd->done, sd->done + nr, sd->nr_done * sizeof(struct io_u *));
+	return nr;
+}
+
+static struct io_u *fio_pvsyncio_event(struct thread_data *td, int event)
+{
+	struct syncio_data *sd = td->io_ops->data;
+
+	return sd->events[event];
+}
+
 static void fio_syncio_cleanup(struct thread_data *td)
 {
-	if (td->io_ops->data) {
-		free(td->io_ops->data);
+	struct syncio_data *sd = td->io_ops->data;
+
+	if (sd) {
+		free(sd->iovecs);
+		free(sd->io_us);
+		free(sd->done);
+		free(sd->events);
+		free(sd);
 		td->io_ops->data = NULL;
 	}
 }
@@ -95,12 +289,41 @@ static int fio_syncio_init(struct thread_data *td)
 {
 	struct syncio_data *sd = malloc(sizeof(*sd));
 
-	sd->last_io_u = NULL;
+	memset(sd, 0, sizeof(*sd));
 	td->io_ops->data = sd;
 	return 0;
 }
 
-static struct ioengine_ops ioengine = {
+static int fio_pvsyncio_init(struct thread_data *td)
+{
+	struct syncio_data *sd;
+
+	fio_syncio_init(td);
+	sd = td->io_ops->data;
+
+	sd->max_queued = td->iodepth;
+	if (sd->max_queued > IOV_MAX)
+		sd->max_queued = IOV_MAX;
+
+	sd->iovecs = malloc(sd->max_queued * sizeof(struct iovec));
+	sd->io_us = malloc(sd->max_queued * sizeof(struct io_u *));
+	sd->done = malloc(td->iodepth * sizeof(struct io_u *));
+	sd->events = malloc(td->iodepth * sizeof(struct io_u *));
+
+	if (!strcmp(td->io_ops->name, "pvsync2")) {
+		sd->pv2 = 1;
+#ifdef FIO_HAVE_PWRITEV2
+		if (td->hipri)
+			sd->rwf_flags |= RWF_HIPRI;
+		if (td->nowait)
+			sd->rwf_flags |= RWF_NOWAIT;
+#endif
+	}
+
+	return 0;
+}
+
+static struct ioengine_ops ioengine_rw = {
 	.name		= "sync",
 	.version	= FIO_IOOPS_VERSION,
 	.init		= fio_syncio_init,
@@ -112,12 +335,57 @@ static struct ioengine_ops ioengine = {
 	.flags		= FIO_SYNCIO,
 };
 
+static struct ioengine_ops ioengine_prw = {
+	.name		= "psync",
+	.version	= FIO_IOOPS_VERSION,
+	.init		= fio_syncio_init,
+	.queue		= fio_psyncio_queue,
+	.getevents	= fio_syncio_getevents,
+	.event		= fio_syncio_event,
+	.cleanup	= fio_syncio_cleanup,
+	.flags		= FIO_SYNCIO,
+};
+
+static struct ioengine_ops ioengine_pvrw = {
+	.name		= "pvsync",
+	.version	= FIO_IOOPS_VERSION,
+	.init		= fio_pvsyncio_init,
+	.queue		= fio_pvsyncio_queue,
+	.commit		= fio_pvsyncio_commit,
+	.getevents	= fio_pvsyncio_getevents,
+	.event		= fio_pvsyncio_event,
+	.cleanup	= fio_syncio_cleanup,
+};
+
+#ifdef FIO_HAVE_PWRITEV2
+static struct ioengine_ops ioengine_pvrw2 = {
+	.name		= "pvsync2",
+	.version	= FIO_IOOPS_VERSION,
+	.init		= fio_pvsyncio_init,
+	.queue		= fio_pvsyncio_queue,
+	.commit		= fio_pvsyncio_commit,
+	.getevents	= fio_pvsyncio_getevents,
+	.event		= fio_pvsyncio_event,
+	.cleanup	= fio_syncio_cleanup,
+};
+#endif
+
 static void fio_init fio_syncio_register(void)
 {
-	register_ioengine(&ioengine);
+	register_ioengine(&ioengine_rw);
+	register_ioengine(&ioengine_prw);
+	register_ioengine(&ioengine_pvrw);
+#ifdef FIO_HAVE_PWRITEV2
+	register_ioengine(&ioengine_pvrw2);
+#endif
 }
 
 static void fio_exit fio_syncio_unregister(void)
 {
-	unregister_ioengine(&ioengine);
+	unregister_ioengine(&ioengine_rw);
+	unregister_ioengine(&ioengine_prw);
+	unregister_ioengine(&ioengine_pvrw);
+#ifdef FIO_HAVE_PWRITEV2
+	unregister_ioengine(&ioengine_pvrw2);
+#endif
 }
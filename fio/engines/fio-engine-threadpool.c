@@ -0,0 +1,375 @@
+/*
+ * threadpool io engine
+ *
+ * Turns regular pread/pwrite/fsync into async io by handing the ios to a
+ * pool of worker threads. That gives a job any iodepth on files where the
+ * kernel has no async io, like buffered io on most file systems.
+ *
+ * ->commit() passes the queued ios to the workers in one go. Workers post
+ * finished ios to a completion ring without taking a lock, a slot is
+ * reserved with an atomic add on the tail. The job is the only consumer,
+ * a NULL slot at the head means nothing (more) has completed. Since no
+ * more than iodepth ios are ever in flight, the ring can't overflow.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "../fio.h"
+#include "../os.h"
+
+struct tp_data {
+	/*
+	 * queued, but not yet committed
+	 */
+	struct io_u **pending;
+	unsigned int nr_pending;
+
+	/*
+	 * committed ios waiting for a worker, protected by lock
+	 */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct io_u **submit;
+	unsigned int submit_head;
+	unsigned int nr_submit;
+	int exit;
+
+	/*
+	 * completion ring
+	 */
+	struct io_u * volatile *ring;
+	unsigned int ring_mask;
+	unsigned int ring_tail;
+	unsigned int ring_head;
+
+	/*
+	 * the job sleeps on done_cond when it waits for completions
+	 */
+	pthread_mutex_t done_lock;
+	pthread_cond_t done_cond;
+	volatile int waiting;
+
+	struct io_u **events;
+	unsigned int depth;
+
+	pthread_t *workers;
+	unsigned int nr_workers;
+};
+
+static void fio_tp_do_io(struct io_u *io_u)
+{
+	struct fio_file *f = io_u->file;
+	long ret;
+
+	if (io_u->ddir == DDIR_READ)
+		ret = pread(f->fd, io_u->buf, io_u->buflen, io_u->offset);
+	else if (io_u->ddir == DDIR_WRITE)
+		ret = pwrite(f->fd, io_u->buf, io_u->buflen, io_u->offset);
+	else {
+		if (fsync(f->fd) < 0)
+			io_u->error = errno;
+		return;
+	}
+
+	if (ret != (long) io_u->buflen) {
+		if (ret > 0) {
+			io_u->resid = io_u->buflen - ret;
+			io_u->error = EIO;
+		} else if (ret < 0)
+			io_u->error = errno;
+		else
+			io_u->error = EIO;
+	}
+}
+
+static void fio_tp_complete(struct tp_data *sd, struct io_u *io_u)
+{
+	unsigned int tail;
+
+	tail = __sync_fetch_and_add(&sd->ring_tail, 1);
+
+	/*
+	 * the io_u must be complete before the job can see it
+	 */
+	write_barrier();
+	sd->ring[tail & sd->ring_mask] = io_u;
+
+	__sync_synchronize();
+	if (sd->waiting) {
+		pthread_mutex_lock(&sd->done_lock);
+		pthread_cond_signal(&sd->done_cond);
+		pthread_mutex_unlock(&sd->done_lock);
+	}
+}
+
+static void *fio_tp_worker(void *data)
+{
+	struct tp_data *sd = data;
+	struct io_u *io_u;
+
+	pthread_mutex_lock(&sd->lock);
+	while (1) {
+		if (!sd->nr_submit) {
+			if (sd->exit)
+				break;
+			pthread_cond_wait(&sd->cond, &sd->lock);
+			continue;
+		}
+
+		io_u = sd->submit[sd->submit_head];
+		sd->submit_head = (sd->submit_head + 1) % sd->depth;
+		sd->nr_submit--;
+		pthread_mutex_unlock(&sd->lock);
+
+		fio_tp_do_io(io_u);
+		fio_tp_complete(sd, io_u);
+
+		pthread_mutex_lock(&sd->lock);
+	}
+	pthread_mutex_unlock(&sd->lock);
+
+	return NULL;
+}
+
+static int fio_tp_commit(struct thread_data *td)
+{
+	struct tp_data *sd = td->io_ops->data;
+	unsigned int i, tail;
+
+	if (!sd->nr_pending)
+		return 0;
+
+	pthread_mutex_lock(&sd->lock);
+	for (i = 0; i < sd->nr_pending; i++) {
+		tail = (sd->submit_head + sd->nr_submit) % sd->depth;
+		sd->submit[tail] = sd->pending[i];
+		sd->nr_submit++;
+	}
+
+	if (sd->nr_pending == 1)
+		pthread_cond_signal(&sd->cond);
+	else
+		pthread_cond_broadcast(&sd->cond);
+	pthread_mutex_unlock(&sd->lock);
+
+	sd->nr_pending = 0;
+	return 0;
+}
+
+/*
+ * Reap completions in to events[nr] and up, returns the new total
+ */
+static int fio_tp_reap(struct tp_data *sd, int nr, int max)
+{
+	struct io_u *io_u;
+
+	while (nr < max) {
+		io_u = sd->ring[sd->ring_head & sd->ring_mask];
+		if (!io_u)
+			break;
+
+		read_barrier();
+		sd->ring[sd->ring_head & sd->ring_mask] = NULL;
+		sd->ring_head++;
+		sd->events[nr++] = io_u;
+	}
+
+	return nr;
+}
+
+static int fio_tp_getevents(struct thread_data *td, int min, int max,
+			    struct timespec *t)
+{
+	struct tp_data *sd = td->io_ops->data;
+	struct timespec deadline;
+	struct timeval now;
+	int r, nr = 0;
+
+	/*
+	 * don't wait for ios the workers were never given
+	 */
+	fio_tp_commit(td);
+
+	if (t) {
+		gettimeofday(&now, NULL);
+		deadline.tv_sec = now.tv_sec + t->tv_sec;
+		deadline.tv_nsec = now.tv_usec * 1000 + t->tv_nsec;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_nsec -= 1000000000;
+			deadline.tv_sec++;
+		}
+	}
+
+	do {
+		nr = fio_tp_reap(sd, nr, max);
+		if (nr >= min)
+			break;
+
+		pthread_mutex_lock(&sd->done_lock);
+		sd->waiting = 1;
+		__sync_synchronize();
+
+		r = 0;
+		if (!sd->ring[sd->ring_head & sd->ring_mask]) {
+			if (t)
+				r = pthread_cond_timedwait(&sd->done_cond, &sd->done_lock, &deadline);
+			else
+				pthread_cond_wait(&sd->done_cond, &sd->done_lock);
+		}
+
+		sd->waiting = 0;
+		pthread_mutex_unlock(&sd->done_lock);
+	} while (r != ETIMEDOUT);
+
+	if (r == ETIMEDOUT)
+		nr = fio_tp_reap(sd, nr, max);
+
+	return nr;
+}
+
+static struct io_u *fio_tp_event(struct thread_data *td, int event)
+{
+	struct tp_data *sd = td->io_ops->data;
+
+	return sd->events[event];
+}
+
+static int fio_tp_queue(struct thread_data *td, struct io_u *io_u)
+{
+	struct tp_data *sd = td->io_ops->data;
+
+	assert(sd->nr_pending < sd->depth);
+
+	sd->pending[sd->nr_pending++] = io_u;
+	return 0;
+}
+
+/*
+ * Only ios that a worker hasn't picked up yet can be cancelled
+ */
+static int fio_tp_cancel(struct thread_data *td, struct io_u *io_u)
+{
+	struct tp_data *sd = td->io_ops->data;
+	unsigned int i, j, this, next;
+	int ret = 1;
+
+	pthread_mutex_lock(&sd->lock);
+	for (i = 0; i < sd->nr_submit; i++) {
+		this = (sd->submit_head + i) % sd->depth;
+		if (sd->submit[this] != io_u)
+			continue;
+
+		for (j = i + 1; j < sd->nr_submit; j++) {
+			next = (sd->submit_head + j) % sd->depth;
+			sd->submit[this] = sd->submit[next];
+			this = next;
+		}
+		sd->nr_submit--;
+		ret = 0;
+		break;
+	}
+	pthread_mutex_unlock(&sd->lock);
+
+	return ret;
+}
+
+static void fio_tp_cleanup(struct thread_data *td)
+{
+	struct tp_data *sd = td->io_ops->data;
+	unsigned int i;
+
+	if (!sd)
+		return;
+
+	pthread_mutex_lock(&sd->lock);
+	sd->exit = 1;
+	pthread_cond_broadcast(&sd->cond);
+	pthread_mutex_unlock(&sd->lock);
+
+	for (i = 0; i < sd->nr_workers; i++)
+		pthread_join(sd->workers[i], NULL);
+
+	free(sd->workers);
+	free(sd->pending);
+	free(sd->submit);
+	free((void *) sd->ring);
+	free(sd->events);
+	free(sd);
+	td->io_ops->data = NULL;
+}
+
+static int fio_tp_init(struct thread_data *td)
+{
+	struct tp_data *sd = malloc(sizeof(*sd));
+	unsigned int i, ring_size, nr_workers;
+
+	memset(sd, 0, sizeof(*sd));
+	td->io_ops->data = sd;
+
+	sd->depth = td->iodepth;
+	ring_size = 1;
+	while (ring_size < sd->depth)
+		ring_size <<= 1;
+
+	sd->ring_mask = ring_size - 1;
+	sd->ring = calloc(ring_size, sizeof(struct io_u *));
+	sd->pending = malloc(sd->depth * sizeof(struct io_u *));
+	sd->submit = malloc(sd->depth * sizeof(struct io_u *));
+	sd->events = malloc(sd->depth * sizeof(struct io_u *));
+
+	pthread_mutex_init(&sd->lock, NULL);
+	pthread_cond_init(&sd->cond, NULL);
+	pthread_mutex_init(&sd->done_lock, NULL);
+	pthread_cond_init(&sd->done_cond, NULL);
+
+	/*
+	 * more workers than ios in flight would just sit idle
+	 */
+	nr_workers = td->threadpool_workers;
+	if (!nr_workers || nr_workers > sd->depth)
+		nr_workers = sd->depth;
+
+	sd->workers = malloc(nr_workers * sizeof(pthread_t));
+	for (i = 0; i < nr_workers; i++) {
+		if (pthread_create(&sd->workers[i], NULL, fio_tp_worker, sd)) {
+			log_err("fio: failed to create threadpool worker\n");
+			break;
+		}
+	}
+
+	sd->nr_workers = i;
+	if (!i) {
+		fio_tp_cleanup(td);
+		td_verror(td, EAGAIN);
+		return 1;
+	}
+
+	return 0;
+}
+
+static struct ioengine_ops ioengine = {
+	.name		= "threadpool",
+	.version	= FIO_IOOPS_VERSION,
+	.init		= fio_tp_init,
+	.queue		= fio_tp_queue,
+	.commit		= fio_tp_commit,
+	.getevents	= fio_tp_getevents,
+	.event		= fio_tp_event,
+	.cancel		= fio_tp_cancel,
+	.cleanup	= fio_tp_cleanup,
+};
+
+static void fio_init fio_tp_register(void)
+{
+	register_ioengine(&ioengine);
+}
+
+static void fio_exit fio_tp_unregister(void)
+{
+	unregister_ioengine(&ioengine);
+}
@@ -51,6 +51,9 @@ static void check_str_update(struct thread_data *td)
 		case TD_CREATED:
 			c = 'C';
 			break;
+		case TD_SETTING_UP:
+			c = 'S';
+			break;
 		case TD_INITIALIZED:
 			c = 'I';
 			break;
@@ -67,7 +70,7 @@ static void check_str_update(struct thread_data *td)
 /*
  * Convert seconds to a printable string.
  */
-static void eta_to_str(char *str, int eta_sec)
+void eta_to_str(char *str, int eta_sec)
 {
 	unsigned int d, h, m, s;
 	static int always_d, always_h;
@@ -123,15 +126,17 @@ static int thread_eta(struct thread_data *td, unsigned long elapsed)
 		double perc;
 
 		bytes_done = td->io_bytes[DDIR_READ] + td->io_bytes[DDIR_WRITE];
+		bytes_done += td->ramp_bytes;
 		perc = (double) bytes_done / (double) bytes_total;
 		if (perc > 1.0)
 			perc = 1.0;
 
 		eta_sec = (unsigned long) (elapsed * (1.0 / perc)) - elapsed;
 
-		if (td->timeout && eta_sec > (td->timeout - elapsed))
-			eta_sec = td->timeout - elapsed;
+		if (td->timeout && eta_sec > (td->timeout + td->ramp_time - elapsed))
+			eta_sec = td->timeout + td->ramp_time - elapsed;
 	} else if (td->runstate == TD_NOT_CREATED || td->runstate == TD_CREATED
+			|| td->runstate == TD_SETTING_UP
 			|| td->runstate == TD_INITIALIZED) {
 		int t_eta = 0, r_eta = 0;
 
@@ -140,7 +145,7 @@ static int thread_eta(struct thread_data *td, unsigned long elapsed)
 		 * if given, otherwise assume it'll run at the specified rate.
 		 */
 		if (td->timeout)
-			t_eta = td->timeout + td->start_delay - elapsed;
+			t_eta = td->timeout + td->ramp_time + td->start_delay - elapsed;
 		if (td->rate) {
 			r_eta = (bytes_total / 1024) / td->rate;
 			r_eta += td->start_delay - elapsed;
@@ -177,7 +182,7 @@ void print_thread_status(void)
 	double perc = 0.0;
 
 	static unsigned long long prev_io_bytes[2];
-	static struct timeval prev_time;
+	static struct timespec prev_time;
 	static unsigned int r_rate, w_rate;
 	unsigned long long io_bytes[2];
 	unsigned long mtime;
@@ -185,6 +190,13 @@ void print_thread_status(void)
 	if (temp_stall_ts || terse_output)
 		return;
 
+	/*
+	 * interval stats are printed as separate lines, don't mix them up
+	 * with the \r updated status line
+	 */
+	if (status_interval && f_out == stdout)
+		return;
+
 	if (!prev_io_bytes[0] && !prev_io_bytes[1])
 		fill_start_time(&prev_time);
 
@@ -236,8 +248,14 @@ void print_thread_status(void)
 
 	mtime = mtime_since_now(&prev_time);
 	if (mtime > 1000) {
-		r_rate = (io_bytes[0] - prev_io_bytes[0]) / mtime;
-		w_rate = (io_bytes[1] - prev_io_bytes[1]) / mtime;
+		/*
+		 * the byte counts go back to zero when a job ends its ramp_time
+		 */
+		r_rate = w_rate = 0;
+		if (io_bytes[0] >= prev_io_bytes[0])
+			r_rate = (io_bytes[0] - prev_io_bytes[0]) / mtime;
+		if (io_bytes[1] >= prev_io_bytes[1])
+			w_rate = (io_bytes[1] - prev_io_bytes[1]) / mtime;
 		fio_gettime(&prev_time, NULL);
 		memcpy(prev_io_bytes, io_bytes, sizeof(io_bytes));
 	}
@@ -4,6 +4,8 @@
 #include <assert.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "fio.h"
 #include "os.h"
@@ -26,72 +28,243 @@ static int file_ok(struct thread_data *td, struct fio_file *f)
 	return 0;
 }
 
-static int create_file(struct thread_data *td, struct fio_file *f)
+/*
+ * Layout of the files of a job, shared by the layout threads
+ */
+struct layout_data {
+	struct thread_data *td;
+	struct fio_file **files;
+	unsigned int nr_files;
+	unsigned int next_file;
+	unsigned int nr_running;
+	unsigned long long bytes_done;
+	unsigned long long bytes_total;
+	int error;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+#define LAYOUT_BS	(1024 * 1024)
+
+static int layout_write(struct layout_data *ld, struct fio_file *f, int fd)
 {
+	struct thread_data *td = ld->td;
+	struct frand_state fs;
 	unsigned long long left;
 	unsigned int bs;
+	int r, err = 0;
 	char *b;
-	int r;
-
-	f->fd = open(f->file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	if (f->fd < 0) {
-		td_verror(td, errno);
-		return 1;
-	}
 
-	if (ftruncate(f->fd, f->file_size) == -1) {
-		td_verror(td, errno);
-		goto err;
-	}
+	bs = td->max_bs[DDIR_WRITE];
+	if (bs < LAYOUT_BS)
+		bs = LAYOUT_BS;
 
-	if (posix_fallocate(f->fd, 0, f->file_size) < 0) {
-		td_verror(td, errno);
-		goto err;
-	}
+	b = malloc(bs);
+	if (!b)
+		return ENOMEM;
 
-	b = malloc(td->max_bs[DDIR_WRITE]);
-	memset(b, 0, td->max_bs[DDIR_WRITE]);
+	if (td->layout_fill == LAYOUT_FILL_RANDOM)
+		frand_seed(&fs, (unsigned long) f ^ getpid());
+	else
+		memset(b, 0, bs);
 
 	left = f->file_size;
 	while (left && !td->terminate) {
-		bs = td->max_bs[DDIR_WRITE];
 		if (bs > left)
 			bs = left;
+		if (td->layout_fill == LAYOUT_FILL_RANDOM)
+			fill_random_buf(&fs, b, bs);
 
-		r = write(f->fd, b, bs);
-
-		if (r == (int) bs) {
-			left -= bs;
-			continue;
-		} else {
-			if (r < 0)
-				td_verror(td, errno);
-			else
-				td_verror(td, EIO);
-
+		r = write(fd, b, bs);
+		if (r != (int) bs) {
+			err = r < 0 ? errno : EIO;
 			break;
 		}
+
+		left -= bs;
+		__sync_fetch_and_add(&ld->bytes_done, bs);
+	}
+
+	free(b);
+	return err;
+}
+
+static int create_file(struct layout_data *ld, struct fio_file *f)
+{
+	struct thread_data *td = ld->td;
+	int fd, err = 0;
+
+	fd = open(f->file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return errno;
+
+	if (ftruncate(fd, f->file_size) == -1) {
+		err = errno;
+		goto out;
+	}
+
+	/*
+	 * get the blocks allocated in one go, rather than as the writes
+	 * come in. file systems that can't do it get emulated writes from
+	 * posix_fallocate(), don't bother then.
+	 */
+	if (td->fallocate) {
+		err = posix_fallocate(fd, 0, f->file_size);
+		if (err == EOPNOTSUPP || err == ENOSYS)
+			err = 0;
+		if (err)
+			goto out;
 	}
 
+	if (td->layout_fill != LAYOUT_FILL_NONE)
+		err = layout_write(ld, f, fd);
+
 	if (td->terminate)
 		unlink(f->file_name);
-	else if (td->create_fsync)
-		fsync(f->fd);
+	else if (!err && td->create_fsync)
+		fsync(fd);
+out:
+	close(fd);
+	return err;
+}
+
+static void *layout_thread(void *data)
+{
+	struct layout_data *ld = data;
+	struct fio_file *f;
+	int err;
+
+	pthread_mutex_lock(&ld->lock);
+	while (ld->next_file < ld->nr_files && !ld->error) {
+		f = ld->files[ld->next_file++];
+		pthread_mutex_unlock(&ld->lock);
+
+		err = create_file(ld, f);
+
+		pthread_mutex_lock(&ld->lock);
+		if (err && !ld->error)
+			ld->error = err;
+	}
+
+	ld->nr_running--;
+	pthread_cond_signal(&ld->cond);
+	pthread_mutex_unlock(&ld->lock);
+	return NULL;
+}
+
+static void layout_status(struct layout_data *ld, struct timespec *start)
+{
+	unsigned long long done = ld->bytes_done;
+	unsigned long elapsed = mtime_since_now(start);
+	unsigned long long rate;
+	char eta_str[32];
+	int eta_sec = 0;
+
+	if (terse_output || !ld->bytes_total)
+		return;
+
+	rate = elapsed ? (done * 1000) / elapsed : 0;
+	if (rate)
+		eta_sec = (ld->bytes_total - done) / rate;
+
+	eta_to_str(eta_str, eta_sec);
+	printf("%s: Laying out: [%3.2f%% done] [%LuMiB/s] [eta %s]\r",
+		ld->td->name, 100.0 * done / ld->bytes_total, rate >> 20, eta_str);
+	fflush(stdout);
+}
+
+/*
+ * Lay out the files with a pool of threads, each working on a file at the
+ * time. Progress is shown every second while they run.
+ */
+static int layout_files(struct thread_data *td, struct fio_file **files,
+			unsigned int nr_files)
+{
+	struct layout_data ld;
+	struct timespec start;
+	struct timespec ts;
+	pthread_t *threads;
+	unsigned int i, nr_threads;
+
+	memset(&ld, 0, sizeof(ld));
+	ld.td = td;
+	ld.files = files;
+	ld.nr_files = nr_files;
+	pthread_mutex_init(&ld.lock, NULL);
+	pthread_cond_init(&ld.cond, NULL);
+
+	if (td->layout_fill != LAYOUT_FILL_NONE)
+		for (i = 0; i < nr_files; i++)
+			ld.bytes_total += files[i]->file_size;
+
+	nr_threads = td->layout_threads;
+	if (!nr_threads)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_threads > nr_files)
+		nr_threads = nr_files;
+
+	threads = malloc(nr_threads * sizeof(pthread_t));
+	if (!threads)
+		return ENOMEM;
+
+	fio_gettime(&start, NULL);
+
+	pthread_mutex_lock(&ld.lock);
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i], NULL, layout_thread, &ld))
+			break;
+		ld.nr_running++;
+	}
+	nr_threads = i;
+
+	/*
+	 * if no threads could be started, do it ourselves
+	 */
+	if (!nr_threads) {
+		pthread_mutex_unlock(&ld.lock);
+		ld.nr_running = 1;
+		layout_thread(&ld);
+		pthread_mutex_lock(&ld.lock);
+	}
+
+	while (ld.nr_running) {
+		ts.tv_sec = time(NULL) + 1;
+		ts.tv_nsec = 0;
+		pthread_cond_timedwait(&ld.cond, &ld.lock, &ts);
+		layout_status(&ld, &start);
+	}
+	pthread_mutex_unlock(&ld.lock);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (ld.bytes_total && !terse_output)
+		printf("\n");
+
+	free(threads);
+	return ld.error;
+}
+
+/*
+ * Is f given more than once in the job, and already on the list?
+ */
+static int file_listed(struct fio_file **files, unsigned int nr,
+		       struct fio_file *f)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++)
+		if (!strcmp(files[i]->file_name, f->file_name))
+			return 1;
 
-	free(b);
-	close(f->fd);
-	f->fd = -1;
 	return 0;
-err:
-	close(f->fd);
-	f->fd = -1;
-	return 1;
 }
 
 static int create_files(struct thread_data *td)
 {
-	struct fio_file *f;
+	struct fio_file *f, **files;
 	int i, err, need_create;
+	unsigned int nr;
 
 	for_each_file(td, f, i)
 		f->file_size = td->total_file_size / td->nr_files;
@@ -105,7 +278,7 @@ static int create_files(struct thread_data *td)
 	need_create = 0;
 	if (td->filetype == FIO_TYPE_FILE)
 		for_each_file(td, f, i)
-			need_create += file_ok(td, f);
+			need_create += !f->layout_owner && file_ok(td, f);
 
 	if (!need_create)
 		return 0;
@@ -122,22 +295,34 @@ static int create_files(struct thread_data *td)
 				(td->total_file_size >> 20) / td->nr_uniq_files,
 				td->total_file_size >> 20);
 
-	err = 0;
+	files = malloc(td->nr_files * sizeof(struct fio_file *));
+	if (!files) {
+		td_verror(td, ENOMEM);
+		return 1;
+	}
+
+	nr = 0;
 	for_each_file(td, f, i) {
 		/*
-		 * Only unlink files that we created.
+		 * Only unlink files that we created. A file shared with an
+		 * earlier job is laid out by that job.
 		 */
 		f->unlink = 0;
+		if (f->layout_owner || file_listed(files, nr, f))
+			continue;
 		if (file_ok(td, f)) {
 			f->unlink = td->unlink;
-			err = create_file(td, f);
-			if (err)
-				break;
+			files[nr++] = f;
 		}
 	}
 
+	err = layout_files(td, files, nr);
+	if (err)
+		td_verror(td, err);
+
+	free(files);
 	temp_stall_ts = 0;
-	return err;
+	return err != 0;
 }
 
 static int file_size(struct thread_data *td, struct fio_file *f)
@@ -253,6 +438,19 @@ static int __setup_file_mmap(struct thread_data *td, struct fio_file *f)
 	if (td->invalidate_cache && file_invalidate_cache(td, f))
 		return 1;
 
+	/*
+	 * transparent huge pages only work for some file systems, so
+	 * failing here isn't fatal
+	 */
+	if (td->mmap_hugepage) {
+#ifdef MADV_HUGEPAGE
+		if (madvise(f->mmap, f->file_size, MADV_HUGEPAGE) < 0)
+			log_err("fio: %s: huge pages not supported\n", f->file_name);
+#else
+		log_err("fio: mmap_hugepage not supported on this platform\n");
+#endif
+	}
+
 	if (td->sequential) {
 		if (madvise(f->mmap, f->file_size, MADV_SEQUENTIAL) < 0) {
 			td_verror(td, errno);
@@ -380,6 +578,88 @@ int open_files(struct thread_data *td)
 	return err;
 }
 
+static int layout_in_job(struct thread_data *td)
+{
+	return !td->create_serialize && td->overwrite &&
+		td->filetype == FIO_TYPE_FILE && !td->io_ops->setup;
+}
+
+/*
+ * Jobs lay out their files in parallel. If several of them use the same
+ * file, only one creates it and the others wait for it to be done. The
+ * owner must not start later than the jobs waiting for it, so it's the
+ * first of the jobs with the shortest startdelay.
+ */
+void mark_shared_files(void)
+{
+	struct thread_data *td, *td2, *owner;
+	struct fio_file *f, *f2;
+	int i, j, k, l;
+
+	for_each_td(td, i) {
+		if (!layout_in_job(td))
+			continue;
+
+		for_each_file(td, f, j) {
+			owner = td;
+
+			for_each_td(td2, k) {
+				if (td2 == td || !layout_in_job(td2))
+					continue;
+				if (td2->start_delay > owner->start_delay ||
+				    (td2->start_delay == owner->start_delay && k > owner - threads))
+					continue;
+
+				for_each_file(td2, f2, l) {
+					if (!strcmp(f->file_name, f2->file_name)) {
+						owner = td2;
+						break;
+					}
+				}
+			}
+
+			f->layout_owner = 0;
+			if (owner != td)
+				f->layout_owner = owner->thread_number;
+		}
+	}
+}
+
+/*
+ * Laying out may take a while, but an owner that doesn't even get
+ * started isn't waited for forever
+ */
+static int wait_shared_files(struct thread_data *td)
+{
+	struct thread_data *owner;
+	struct timespec start;
+	struct fio_file *f;
+	int i;
+
+	fio_gettime(&start, NULL);
+
+	for_each_file(td, f, i) {
+		if (!f->layout_owner)
+			continue;
+
+		owner = &threads[f->layout_owner - 1];
+		while (!owner->files_ready && owner->runstate < TD_EXITED &&
+		       !owner->terminate) {
+			if (td->terminate)
+				return 1;
+			if (owner->runstate < TD_SETTING_UP &&
+			    mtime_since_now(&start) > JOB_START_TIMEOUT) {
+				log_err("fio: %s: %s never started laying out %s\n", td->name, owner->name, f->file_name);
+				td_verror(td, ETIMEDOUT);
+				return 1;
+			}
+			usleep(10000);
+		}
+	}
+
+	return 0;
+}
+
 int setup_files(struct thread_data *td)
 {
 	struct fio_file *f;
@@ -395,6 +675,10 @@ int setup_files(struct thread_data *td)
 	if (create_files(td))
 		return 1;
 
+	td->files_ready = 1;
+	if (wait_shared_files(td))
+		return 1;
+
 	err = open_files(td);
 	if (err)
 		return err;
@@ -453,8 +737,13 @@ void close_files(struct thread_data *td)
 			munmap(f->mmap, f->file_size);
 			f->mmap = NULL;
 		}
+		axmap_free(f->file_map);
+		f->file_map = NULL;
 	}
 
+	dist_alias_free(&td->offset_alias);
+	dist_alias_free(&td->file_alias);
+
 	td->filename = NULL;
 	free(td->files);
 	td->files = NULL;
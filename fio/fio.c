@@ -46,10 +46,13 @@ int thread_number = 0;
 int shm_id = 0;
 int temp_stall_ts;
 
-static volatile int startup_sem;
+/*
+ * Jobs that are set up wait at the start gate. It's a pipe, closing the
+ * write end lets every job waiting on the read end go at once.
+ */
+static int start_gate[2] = { -1, -1 };
 
 #define TERMINATE_ALL		(-1)
-#define JOB_START_TIMEOUT	(5 * 1000)
 
 static void terminate_threads(int group_id)
 {
@@ -71,6 +74,8 @@ static void sig_handler(int sig)
 			update_io_ticks();
 			disk_util_timer_arm();
 			print_thread_status();
+			if (status_interval)
+				show_interval_stats();
 			break;
 		default:
 			printf("\nfio: terminating on signal\n");
@@ -83,7 +88,7 @@ static void sig_handler(int sig)
 /*
  * Check if we are above the minimum rate given.
  */
-static int check_min_rate(struct thread_data *td, struct timeval *now)
+static int check_min_rate(struct thread_data *td, struct timespec *now)
 {
 	unsigned long spent;
 	unsigned long rate;
@@ -115,11 +120,11 @@ static int check_min_rate(struct thread_data *td, struct timeval *now)
 	return 0;
 }
 
-static inline int runtime_exceeded(struct thread_data *td, struct timeval *t)
+static inline int runtime_exceeded(struct thread_data *td, struct timespec *t)
 {
 	if (!td->timeout)
 		return 0;
-	if (mtime_since(&td->epoch, t) >= td->timeout * 1000)
+	if (mtime_since(&td->epoch, t) >= (td->timeout + td->ramp_time) * 1000)
 		return 1;
 
 	return 0;
@@ -135,6 +140,12 @@ static struct fio_file *get_next_file(struct thread_data *td)
 	unsigned int old_next_file = td->next_file;
 	struct fio_file *f;
 
+	if (td->file_dist.type != FIO_DIST_NONE) {
+		f = &td->files[dist_alias_next(&td->file_alias, &td->dist_state)];
+		if (f->fd != -1)
+			return f;
+	}
+
 	do {
 		f = &td->files[td->next_file];
 
@@ -158,11 +169,17 @@ static struct fio_file *get_next_file(struct thread_data *td)
 static void cleanup_pending_aio(struct thread_data *td)
 {
 	struct timespec ts = { .tv_sec = 0, .tv_nsec = 0};
-	struct list_head *entry, *n;
 	struct io_completion_data icd;
 	struct io_u *io_u;
+	unsigned int i;
 	int r;
 
+	/*
+	 * io_u's that were queued but never committed must go out before
+	 * we can reap them
+	 */
+	td_io_commit(td);
+
 	/*
 	 * get immediately available events, if any
 	 */
@@ -173,12 +190,11 @@ static void cleanup_pending_aio(struct thread_data *td)
 	}
 
 	/*
-	 * now cancel remaining active events
+	 * now cancel remaining active events. if the job wasn't stopped
+	 * early they are part of the workload, so let them finish.
 	 */
-	if (td->io_ops->cancel) {
-		list_for_each_safe(entry, n, &td->io_u_busylist) {
-			io_u = list_entry(entry, struct io_u, list);
-
+	if (td->io_ops->cancel && td->terminate) {
+		for_each_busy_io_u(td, io_u, i) {
 			r = td->io_ops->cancel(td, io_u);
 			if (!r)
 				put_io_u(td, io_u);
@@ -222,6 +238,12 @@ static int fio_io_sync(struct thread_data *td, struct fio_file *f)
 		return 1;
 	}
 
+	ret = td_io_commit(td);
+	if (ret) {
+		td_verror(td, ret);
+		return 1;
+	}
+
 	ret = td_io_getevents(td, 1, td->cur_depth, NULL);
 	if (ret < 0) {
 		td_verror(td, ret);
@@ -238,16 +260,61 @@ static int fio_io_sync(struct thread_data *td, struct fio_file *f)
 	return 0;
 }
 
+/*
+ * Reap completed verify reads. Each one is checked inline, or handed to
+ * the verify_async threads. Returns 1 on error or verify failure.
+ */
+static int verify_reap_events(struct thread_data *td, int min_evts,
+			      int max_evts, struct timespec *timeout)
+{
+	struct io_completion_data icd;
+	struct io_u *io_u;
+	int ret, i, err = 0;
+
+	ret = td_io_getevents(td, min_evts, max_evts, timeout);
+	if (ret < 0) {
+		td_verror(td, ret);
+		return 1;
+	}
+
+	icd.nr = ret;
+	icd.error = 0;
+	icd.bytes_done[0] = icd.bytes_done[1] = 0;
+	fio_gettime(&icd.time, NULL);
+
+	for (i = 0; i < ret; i++) {
+		io_u = td->io_ops->event(td, i);
+
+		io_completed(td, io_u, &icd);
+		if (icd.error) {
+			td_verror(td, icd.error);
+			put_io_u(td, io_u);
+			err = 1;
+		} else if (err)
+			put_io_u(td, io_u);
+		else if (td->verify_async)
+			verify_io_u_async(td, io_u);
+		else if (do_io_u_verify(td, &io_u))
+			err = 1;
+	}
+
+	return err;
+}
+
 /*
  * The main verify engine. Runs over the writes we previusly submitted,
- * reads the blocks back in, and checks the crc/md5 of the data.
+ * reads the blocks back in, and checks the crc/md5 of the data. Reads are
+ * issued at the full iodepth, the checksumming can be offloaded to
+ * verify_async threads so it overlaps with the io.
  */
 static void do_verify(struct thread_data *td)
 {
-	struct io_u *io_u, *v_io_u = NULL;
-	struct io_completion_data icd;
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 0};
+	struct timespec *timeout;
 	struct fio_file *f;
-	int ret, i;
+	struct io_u *io_u;
+	unsigned int in_flight;
+	int ret, i, min_evts, max_evts, done = 0;
 
 	/*
 	 * sync io first and invalidate cache, to make sure we really
@@ -258,80 +325,97 @@ static void do_verify(struct thread_data *td)
 		file_invalidate_cache(td, f);
 	}
 
+	if (td->verify_async && verify_async_init(td))
+		return;
+
 	td_set_runstate(td, TD_VERIFYING);
 
 	do {
 		if (td->terminate)
 			break;
 
-		io_u = __get_io_u(td);
-		if (!io_u)
+		if (td->verify_async && verify_async_reap(td, 0))
 			break;
 
-		if (runtime_exceeded(td, &io_u->start_time)) {
-			put_io_u(td, io_u);
-			break;
-		}
+		io_u = NULL;
+		if (!done)
+			io_u = __get_io_u(td);
 
-		if (get_next_verify(td, io_u)) {
-			put_io_u(td, io_u);
-			break;
-		}
+		if (io_u) {
+			if (runtime_exceeded(td, &io_u->start_time)) {
+				put_io_u(td, io_u);
+				break;
+			}
 
-		f = get_next_file(td);
-		if (!f)
-			break;
+			if (get_next_verify(td, io_u)) {
+				put_io_u(td, io_u);
+				done = 1;
+			} else {
+				if (!io_u->file) {
+					io_u->file = get_next_file(td);
+					if (!io_u->file) {
+						put_io_u(td, io_u);
+						break;
+					}
+				}
 
-		io_u->file = f;
+				if (td_io_prep(td, io_u)) {
+					put_io_u(td, io_u);
+					break;
+				}
 
-		if (td_io_prep(td, io_u)) {
-			put_io_u(td, io_u);
-			break;
+				ret = td_io_queue(td, io_u);
+				if (ret) {
+					td_verror(td, io_u->error);
+					put_io_u(td, io_u);
+					break;
+				}
+
+				if (td->io_u_queued < td->iodepth_batch &&
+				    !queue_full(td))
+					continue;
+			}
 		}
 
-		ret = td_io_queue(td, io_u);
+		ret = td_io_commit(td);
 		if (ret) {
-			td_verror(td, io_u->error);
-			put_io_u(td, io_u);
+			td_verror(td, ret);
 			break;
 		}
 
 		/*
-		 * we have one pending to verify, do that while
-		 * we are doing io on the next one
+		 * io_u's with the verify threads aren't in flight
 		 */
-		if (do_io_u_verify(td, &v_io_u))
-			break;
-
-		ret = td_io_getevents(td, 1, 1, NULL);
-		if (ret != 1) {
-			if (ret < 0)
-				td_verror(td, ret);
-			break;
+		in_flight = io_u_in_flight(td);
+		if (!in_flight) {
+			if (!td->verify_held) {
+				if (done)
+					break;
+				continue;
+			}
+			if (verify_async_reap(td, 1))
+				break;
+			continue;
 		}
 
-		v_io_u = td->io_ops->event(td, 0);
-		icd.nr = 1;
-		icd.error = 0;
-		fio_gettime(&icd.time, NULL);
-		io_completed(td, v_io_u, &icd);
-
-		if (icd.error) {
-			td_verror(td, icd.error);
-			put_io_u(td, v_io_u);
-			v_io_u = NULL;
-			break;
+		if (done || queue_full(td)) {
+			timeout = NULL;
+			min_evts = min(td->iodepth_batch_complete, in_flight);
+		} else {
+			timeout = &ts;
+			min_evts = 0;
 		}
 
-		/*
-		 * if we can't submit more io, we need to verify now
-		 */
-		if (queue_full(td) && do_io_u_verify(td, &v_io_u))
-			break;
+		max_evts = min(td->iodepth_batch_complete_max, in_flight);
 
+		if (verify_reap_events(td, min_evts, max_evts, timeout))
+			break;
 	} while (1);
 
-	do_io_u_verify(td, &v_io_u);
+	if (td->verify_async) {
+		verify_async_exit(td);
+		verify_async_reap(td, 0);
+	}
 
 	if (td->cur_depth)
 		cleanup_pending_aio(td);
@@ -345,7 +429,7 @@ static void do_verify(struct thread_data *td)
  */
 static void do_cpuio(struct thread_data *td)
 {
-	struct timeval e;
+	struct timespec e;
 	int split = 100 / td->cpuload;
 	int i = 0;
 
@@ -364,6 +448,116 @@ static void do_cpuio(struct thread_data *td)
 	}
 }
 
+/*
+ * When replaying a timestamped iolog, reap completions while waiting for
+ * the next logged io to become due.
+ */
+static int iolog_wait(struct thread_data *td)
+{
+	struct io_completion_data icd;
+	struct timespec ts;
+	unsigned long usec;
+	int ret;
+
+	while ((usec = iolog_delay(td)) != 0) {
+		if (td->terminate)
+			return 1;
+
+		/*
+		 * don't hold back io_u's queued for a batched commit
+		 */
+		ret = td_io_commit(td);
+		if (ret) {
+			td_verror(td, ret);
+			return 1;
+		}
+
+		if (!td->cur_depth) {
+			usec_sleep(td, min(usec, 100000UL));
+			continue;
+		}
+
+		ts.tv_sec = usec / 1000000;
+		ts.tv_nsec = (usec % 1000000) * 1000;
+
+		ret = td_io_getevents(td, 1, td->cur_depth, &ts);
+		if (ret < 0) {
+			td_verror(td, ret);
+			return 1;
+		} else if (!ret)
+			continue;
+
+		icd.nr = ret;
+		ios_completed(td, &icd);
+		if (icd.error) {
+			td_verror(td, icd.error);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * With open loop rate control, wait for the next io to be due. As with a
+ * replayed iolog, completions are reaped while waiting. Close to the
+ * arrival, the engine is polled rather than waited on.
+ */
+static int rate_wait(struct thread_data *td)
+{
+	struct io_completion_data icd;
+	struct timespec ts;
+	unsigned long long nsec;
+	int ret;
+
+	while ((nsec = rate_open_next(td)) != 0) {
+		if (td->terminate)
+			return 1;
+
+		ret = td_io_commit(td);
+		if (ret) {
+			td_verror(td, ret);
+			return 1;
+		}
+
+		if (!td->cur_depth) {
+			rate_open_sleep(td, min(nsec, 100000000ULL));
+			continue;
+		}
+
+		/*
+		 * wait for completions until rate_spin before the arrival,
+		 * from there on just poll
+		 */
+		if (nsec <= td->rate_spin * 1000ULL)
+			nsec = 0;
+		else
+			nsec -= td->rate_spin * 1000ULL;
+
+		ts.tv_sec = nsec / 1000000000ULL;
+		ts.tv_nsec = nsec % 1000000000ULL;
+
+		ret = td_io_getevents(td, nsec ? 1 : 0, td->cur_depth, &ts);
+		if (ret < 0) {
+			td_verror(td, ret);
+			return 1;
+		} else if (!ret)
+			continue;
+
+		icd.nr = ret;
+		ios_completed(td, &icd);
+		if (icd.error) {
+			td_verror(td, icd.error);
+			return 1;
+		}
+
+		if (runtime_exceeded(td, &icd.time))
+			return 1;
+	}
+
+	return 0;
+}
+
 /*
  * Main IO worker function. It retrieves io_u's to process and queues
  * and reaps them, checking for rate and errors along the way.
@@ -371,22 +565,33 @@ static void do_cpuio(struct thread_data *td)
 static void do_io(struct thread_data *td)
 {
 	struct io_completion_data icd;
-	struct timeval s;
+	struct timespec s;
 	unsigned long usec;
 	struct fio_file *f;
 	int i, ret = 0;
 
 	td_set_runstate(td, TD_RUNNING);
 
-	while (td->this_io_bytes[td->ddir] < td->io_size) {
+	if (td->rate_open)
+		rate_open_init(td);
+
+	/*
+	 * a replayed iolog runs until the log is exhausted
+	 */
+	while (td->read_iolog || td->this_io_bytes[td->ddir] < td->io_size) {
 		struct timespec ts = { .tv_sec = 0, .tv_nsec = 0};
 		struct timespec *timeout;
-		int min_evts = 0;
+		int min_evts = 0, max_evts;
 		struct io_u *io_u;
 
 		if (td->terminate)
 			break;
 
+		if (td->read_iolog && iolog_wait(td))
+			break;
+		if (td->rate_open && rate_wait(td))
+			break;
+
 		f = get_next_file(td);
 		if (!f)
 			break;
@@ -395,6 +600,9 @@ static void do_io(struct thread_data *td)
 		if (!io_u)
 			break;
 
+		if (td->rate_open)
+			rate_open_arrival(td, io_u);
+
 		memcpy(&s, &io_u->start_time, sizeof(s));
 
 		ret = td_io_queue(td, io_u);
@@ -404,17 +612,38 @@ static void do_io(struct thread_data *td)
 			break;
 		}
 
-		add_slat_sample(td, io_u->ddir, mtime_since(&io_u->start_time, &io_u->issue_time));
+		if (io_u->ddir != DDIR_SYNC)
+			add_slat_sample(td, io_u->ddir, ntime_since(&io_u->start_time, &io_u->issue_time));
 
+		/*
+		 * keep filling up the batch, as long as we have free io_u's
+		 * left. once full, submit the lot with a single commit.
+		 */
+		if (td->io_u_queued < td->iodepth_batch && !queue_full(td))
+			continue;
+
+		ret = td_io_commit(td);
+		if (ret) {
+			td_verror(td, ret);
+			break;
+		}
+
+		/*
+		 * if the queue is full, we have to wait for completions. wait
+		 * for a batch of them, so the queue gets refilled in bulk
+		 * rather than alternating between one reap and one submit.
+		 */
 		if (td->cur_depth < td->iodepth) {
 			timeout = &ts;
 			min_evts = 0;
 		} else {
 			timeout = NULL;
-			min_evts = 1;
+			min_evts = min(td->iodepth_batch_complete, td->cur_depth);
 		}
 
-		ret = td_io_getevents(td, min_evts, td->cur_depth, timeout);
+		max_evts = min(td->iodepth_batch_complete_max, td->cur_depth);
+
+		ret = td_io_getevents(td, min_evts, max_evts, timeout);
 		if (ret < 0) {
 			td_verror(td, ret);
 			break;
@@ -428,6 +657,10 @@ static void do_io(struct thread_data *td)
 			break;
 		}
 
+		if (!td->ramp_time_over &&
+		    mtime_since(&td->epoch, &icd.time) >= td->ramp_time * 1000)
+			reset_io_stats(td);
+
 		/*
 		 * the rate is batched for now, it should work for batches
 		 * of completions except the very first one which may look
@@ -447,6 +680,9 @@ static void do_io(struct thread_data *td)
 		if (runtime_exceeded(td, &icd.time))
 			break;
 
+		if (td->ss_dur && steadystate_check(td, &icd.time))
+			break;
+
 		if (td->thinktime)
 			usec_sleep(td, td->thinktime);
 	}
@@ -465,32 +701,17 @@ static void do_io(struct thread_data *td)
 
 static void cleanup_io_u(struct thread_data *td)
 {
-	struct list_head *entry, *n;
-	struct io_u *io_u;
-
-	list_for_each_safe(entry, n, &td->io_u_freelist) {
-		io_u = list_entry(entry, struct io_u, list);
-
-		list_del(&io_u->list);
-		free(io_u);
-	}
+	free(td->io_us);
+	free(td->io_u_free);
+	free(td->io_u_busy);
+	td->io_us = NULL;
+	td->io_u_free = NULL;
+	td->io_u_busy = NULL;
+	td->io_u_nr = td->io_u_nr_free = 0;
 
 	free_io_mem(td);
 }
 
-/*
- * "randomly" fill the buffer contents
- */
-static void fill_rand_buf(struct io_u *io_u, int max_bs)
-{
-	int *ptr = io_u->buf;
-
-	while ((void *) ptr - io_u->buf < max_bs) {
-		*ptr = rand() * 0x9e370001;
-		ptr++;
-	}
-}
-
 static int init_io_u(struct thread_data *td)
 {
 	struct io_u *io_u;
@@ -517,20 +738,41 @@ static int init_io_u(struct thread_data *td)
 	if (allocate_io_mem(td))
 		return 1;
 
+	/*
+	 * all io_u's in one cache line aligned array, so the free stack and
+	 * busy map can refer to them by index
+	 */
+	if (posix_memalign((void **) &td->io_us, FIO_CACHELINE, max_units * sizeof(struct io_u)))
+		td->io_us = NULL;
+	td->io_u_free = malloc(max_units * sizeof(unsigned int));
+	td->io_u_busy = calloc((max_units + BITS_PER_LONG - 1) / BITS_PER_LONG, sizeof(unsigned long));
+	if (!td->io_us || !td->io_u_free || !td->io_u_busy) {
+		td_verror(td, ENOMEM);
+		cleanup_io_u(td);
+		return 1;
+	}
+
+	memset(td->io_us, 0, max_units * sizeof(struct io_u));
+	td->io_u_nr = max_units;
+
 	p = ALIGN(td->orig_buffer);
 	for (i = 0; i < max_units; i++) {
-		io_u = malloc(sizeof(*io_u));
-		memset(io_u, 0, sizeof(*io_u));
+		io_u = &td->io_us[i];
 		INIT_LIST_HEAD(&io_u->list);
 
 		io_u->buf = p + max_bs * i;
 		if (td_write(td) || td_rw(td))
-			fill_rand_buf(io_u, max_bs);
+			fill_io_buffer(td, io_u->buf, max_bs);
 
 		io_u->index = i;
-		list_add(&io_u->list, &td->io_u_freelist);
+
+		/*
+		 * stacked so io_u 0 is handed out first
+		 */
+		td->io_u_free[max_units - 1 - i] = i;
 	}
 
+	td->io_u_nr_free = max_units;
 	return 0;
 }
 
@@ -595,12 +837,10 @@ static void clear_io_state(struct thread_data *td)
 	td->zone_bytes = 0;
 
 	for_each_file(td, f, i) {
-		f->last_pos = 0;
 		if (td->io_ops->flags & FIO_SYNCIO)
 			lseek(f->fd, SEEK_SET, 0);
 
-		if (f->file_map)
-			memset(f->file_map, 0, f->num_maps * sizeof(long));
+		reset_file_io_state(td, f);
 	}
 }
 
@@ -612,18 +852,21 @@ static void *thread_main(void *data)
 {
 	unsigned long long runtime[2];
 	struct thread_data *td = data;
+	int ramped;
+	char c;
 
 	if (!td->use_thread)
 		setsid();
 
 	td->pid = getpid();
 
-	INIT_LIST_HEAD(&td->io_u_freelist);
-	INIT_LIST_HEAD(&td->io_u_busylist);
 	INIT_LIST_HEAD(&td->io_hist_list);
-	INIT_LIST_HEAD(&td->io_log_list);
 
-	if (init_io_u(td))
+	/*
+	 * get placed before allocating anything, so the memory ends up on
+	 * the right node
+	 */
+	if (fio_numa_setup(td))
 		goto err;
 
 	if (fio_setaffinity(td) == -1) {
@@ -631,6 +874,15 @@ static void *thread_main(void *data)
 		goto err;
 	}
 
+	/*
+	 * the buffer contents come from the random state, set it up first
+	 */
+	if (init_random_state(td))
+		goto err;
+
+	if (init_io_u(td))
+		goto err;
+
 	if (td_io_init(td))
 		goto err;
 
@@ -649,18 +901,26 @@ static void *thread_main(void *data)
 		goto err;
 	}
 
-	if (init_random_state(td))
+	if (td->ioscheduler && switch_ioscheduler(td))
 		goto err;
 
-	if (td->ioscheduler && switch_ioscheduler(td))
+	/*
+	 * all jobs of a batch set up their files at the same time, and are
+	 * then let go together
+	 */
+	td_set_runstate(td, TD_SETTING_UP);
+	if (!td->create_serialize && setup_files(td))
 		goto err;
 
+	td->startup_msec = mtime_since_genesis();
 	td_set_runstate(td, TD_INITIALIZED);
-	fio_sem_up(&startup_sem);
-	fio_sem_down(&td->mutex);
 
-	if (!td->create_serialize && setup_files(td))
+	while (read(td->start_gate, &c, 1) < 0 && errno == EINTR)
+		;
+
+	if (td->terminate)
 		goto err;
+
 	if (open_files(td))
 		goto err;
 
@@ -670,8 +930,13 @@ static void *thread_main(void *data)
 	fio_gettime(&td->epoch, NULL);
 	getrusage(RUSAGE_SELF, &td->ru_start);
 
+	td->ramp_time_over = !td->ramp_time;
+	if (td->ss_dur && steadystate_init(td))
+		goto err;
+
 	runtime[0] = runtime[1] = 0;
-	while (td->loops--) {
+	while (!td->ss_attained && td->loops--) {
+		ramped = td->ramp_time_over;
 		fio_gettime(&td->start, NULL);
 		memcpy(&td->stat_sample_time, &td->start, sizeof(td->start));
 
@@ -686,6 +951,13 @@ static void *thread_main(void *data)
 		else
 			do_io(td);
 
+		/*
+		 * td->start was moved up to the end of the ramp, and earlier
+		 * loops don't count either
+		 */
+		if (!ramped && td->ramp_time_over)
+			runtime[0] = runtime[1] = 0;
+
 		runtime[td->ddir] += utime_since_now(&td->start);
 		if (td_rw(td) && td->io_bytes[td->ddir ^ 1])
 			runtime[td->ddir ^ 1] = runtime[td->ddir];
@@ -709,17 +981,21 @@ static void *thread_main(void *data)
 
 	update_rusage_stat(td);
 	fio_gettime(&td->end_time, NULL);
+	if (status_interval)
+		update_io_snapshot(td, NULL);
 	td->runtime[0] = runtime[0] / 1000;
 	td->runtime[1] = runtime[1] / 1000;
 
 	if (td->bw_log)
-		finish_log(td, td->bw_log, "bw");
+		finish_log(td->bw_log);
 	if (td->slat_log)
-		finish_log(td, td->slat_log, "slat");
+		finish_log(td->slat_log);
 	if (td->clat_log)
-		finish_log(td, td->clat_log, "clat");
+		finish_log(td->clat_log);
 	if (td->write_iolog_file)
 		write_iolog_close(td);
+	if (td->read_iolog)
+		read_iolog_close(td);
 	if (td->exec_postrun)
 		system(td->exec_postrun);
 
@@ -730,6 +1006,8 @@ err:
 	close_files(td);
 	close_ioengine(td);
 	cleanup_io_u(td);
+	free(td->ss_samples);
+	td->ss_samples = NULL;
 	td_set_runstate(td, TD_EXITED);
 	return NULL;
 
@@ -810,6 +1088,7 @@ static void run_threads(void)
 	struct thread_data *td;
 	unsigned long spent;
 	int i, todo, nr_running, m_rate, t_rate, nr_started;
+	int *gates, nr_gates;
 
 	if (fio_pin_memory())
 		return;
@@ -827,6 +1106,18 @@ static void run_threads(void)
 	nr_started = 0;
 	m_rate = t_rate = 0;
 
+	if (status_interval)
+		init_interval_stats();
+
+	fio_numa_spread();
+
+	/*
+	 * the read end of the start gate of every batch of jobs, they are
+	 * closed once all jobs are done
+	 */
+	gates = malloc(thread_number * sizeof(int));
+	nr_gates = 0;
+
 	for_each_td(td, i) {
 		print_status_init(td->thread_number - 1);
 
@@ -846,10 +1137,12 @@ static void run_threads(void)
 		}
 	}
 
+	mark_shared_files();
+
 	while (todo) {
 		struct thread_data *map[MAX_JOBS];
-		struct timeval this_start;
-		int this_jobs = 0, left;
+		struct timespec this_start;
+		int this_jobs = 0, left, setting_up;
 
 		/*
 		 * create threads (TD_NOT_CREATED -> TD_CREATED)
@@ -877,13 +1170,27 @@ static void run_threads(void)
 			if (td->stonewall && (nr_started || nr_running))
 				break;
 
+			/*
+			 * each batch of jobs gets its own start gate
+			 */
+			if (start_gate[1] == -1) {
+				if (pipe(start_gate)) {
+					perror("pipe");
+					todo = 0;
+					break;
+				}
+				gates[nr_gates++] = start_gate[0];
+			}
+
 			/*
 			 * Set state to created. Thread will transition
 			 * to TD_INITIALIZED when it's done setting up.
+			 * Jobs are not waited for one by one, they all
+			 * set up at the same time.
 			 */
 			td_set_runstate(td, TD_CREATED);
+			td->start_gate = start_gate[0];
 			map[this_jobs++] = td;
-			fio_sem_init(&startup_sem, 1);
 			nr_started++;
 
 			if (td->use_thread) {
@@ -891,28 +1198,22 @@ static void run_threads(void)
 					perror("thread_create");
 					nr_started--;
 				}
-			} else {
-				if (fork())
-					fio_sem_down(&startup_sem);
-				else {
-					fork_main(shm_id, i);
-					exit(0);
-				}
+			} else if (!fork()) {
+				close(start_gate[1]);
+				fork_main(shm_id, i);
+				exit(0);
 			}
 		}
 
 		/*
 		 * Wait for the started threads to transition to
-		 * TD_INITIALIZED.
+		 * TD_INITIALIZED. Laying out files may take a while, the
+		 * timeout is only for jobs that don't get that far.
 		 */
 		fio_gettime(&this_start, NULL);
 		left = this_jobs;
 		while (left) {
-			if (mtime_since_now(&this_start) > JOB_START_TIMEOUT)
-				break;
-
-			usleep(100000);
-
+			setting_up = 0;
 			for (i = 0; i < this_jobs; i++) {
 				td = map[i];
 				if (!td)
@@ -925,8 +1226,17 @@ static void run_threads(void)
 					left--;
 					todo--;
 					nr_running++; /* work-around... */
-				}
+				} else if (td->runstate == TD_SETTING_UP)
+					setting_up++;
 			}
+
+			if (!left)
+				break;
+			if (left > setting_up &&
+			    mtime_since_now(&this_start) > JOB_START_TIMEOUT)
+				break;
+
+			usleep(10000);
 		}
 
 		if (left) {
@@ -937,11 +1247,23 @@ static void run_threads(void)
 					continue;
 				kill(td->pid, SIGTERM);
 			}
+
+			/*
+			 * the jobs of the batch that did get set up are
+			 * waiting at the gate, let them through to exit
+			 */
+			for_each_td(td, i) {
+				if (td->start_gate == start_gate[0])
+					td->terminate = 1;
+			}
+			close(start_gate[1]);
+			start_gate[1] = -1;
 			break;
 		}
 
 		/*
-		 * start created threads (TD_INITIALIZED -> TD_RUNNING).
+		 * start created threads (TD_INITIALIZED -> TD_RUNNING),
+		 * all of them at once by opening the gate.
 		 */
 		for_each_td(td, i) {
 			if (td->runstate != TD_INITIALIZED)
@@ -953,7 +1275,11 @@ static void run_threads(void)
 			m_rate += td->ratemin;
 			t_rate += td->rate;
 			todo--;
-			fio_sem_up(&td->mutex);
+		}
+
+		if (start_gate[1] != -1) {
+			close(start_gate[1]);
+			start_gate[1] = -1;
 		}
 
 		reap_threads(&nr_running, &t_rate, &m_rate);
@@ -967,6 +1293,10 @@ static void run_threads(void)
 		usleep(10000);
 	}
 
+	for (i = 0; i < nr_gates; i++)
+		close(gates[i]);
+	free(gates);
+
 	update_io_ticks();
 	fio_unpin_memory();
 }
@@ -976,6 +1306,11 @@ int main(int argc, char *argv[])
 	if (parse_options(argc, argv))
 		return 1;
 
+	if (fio_clock_init())
+		return 1;
+
+	fio_time_init();
+
 	if (!thread_number) {
 		log_err("Nothing to do\n");
 		return 1;
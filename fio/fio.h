@@ -15,6 +15,12 @@
 #include "list.h"
 #include "md5.h"
 #include "crc32.h"
+#include "crc32c.h"
+#include "xxhash.h"
+#include "rand.h"
+#include "dist.h"
+#include "lfsr.h"
+#include "axmap.h"
 #include "arch.h"
 #include "os.h"
 
@@ -25,23 +31,94 @@ enum fio_ddir {
 };
 
 struct io_stat {
-	unsigned long val;
-	unsigned long val_sq;
-	unsigned long max_val;
-	unsigned long min_val;
-	unsigned long samples;
+	unsigned long long max_val;
+	unsigned long long min_val;
+	unsigned long long samples;
+
+	/*
+	 * running mean and sum of squared differences (Welford), as
+	 * squares of nsec values quickly overflow a plain sum
+	 */
+	double mean;
+	double S;
+};
+
+/*
+ * Latency histogram buckets. Values below 2 * FIO_IO_U_PLAT_VAL get a
+ * bucket each, above that every power of two is split into
+ * FIO_IO_U_PLAT_VAL buckets. That keeps the error below
+ * 1 / FIO_IO_U_PLAT_VAL (~1.5%), and with the latencies in nsecs the
+ * last group starts at ~8 seconds.
+ */
+#define FIO_IO_U_PLAT_BITS	6
+#define FIO_IO_U_PLAT_VAL	(1 << FIO_IO_U_PLAT_BITS)
+#define FIO_IO_U_PLAT_GROUP_NR	29
+#define FIO_IO_U_PLAT_NR	(FIO_IO_U_PLAT_GROUP_NR * FIO_IO_U_PLAT_VAL)
+
+/*
+ * Running totals a job publishes for the main thread to build interval
+ * stats from. seq is odd while the job is updating it, readers retry if
+ * it changed under them.
+ */
+struct io_snapshot {
+	volatile unsigned int seq;
+	unsigned int reset;		/* bumped when the stats are reset */
+	unsigned long long io_bytes[2];
+	unsigned long long io_blocks[2];
+	unsigned int clat_plat[2][FIO_IO_U_PLAT_NR];
 };
 
 struct io_sample {
 	unsigned long time;
-	unsigned long val;
+	unsigned long long val;
 	enum fio_ddir ddir;
 };
 
-struct io_log {
+/*
+ * Format of the slat/clat/bw logs
+ */
+enum fio_log_format {
+	LOG_FORMAT_TEXT = 0,	/* "time, value, ddir" lines */
+	LOG_FORMAT_BINARY,	/* varint encoded, see log.c */
+};
+
+/*
+ * Samples are collected in fixed size chunks. Full chunks are handed to a
+ * writer thread that streams them to the log file, so memory use stays
+ * bounded no matter how long the job runs.
+ */
+#define LOG_CHUNK_SAMPLES	4096
+#define LOG_MAX_CHUNKS		8
+
+struct io_log_chunk {
+	struct list_head list;
 	unsigned long nr_samples;
+	struct io_sample samples[LOG_CHUNK_SAMPLES];
+};
+
+struct io_log {
+	unsigned long nr_samples;	/* in the chunk being filled */
 	unsigned long max_samples;
 	struct io_sample *log;
+	struct io_log_chunk *chunk;
+
+	char *file_name;
+	enum fio_log_format format;
+	FILE *f;
+	unsigned long last_time;
+	int error;
+
+	/*
+	 * writer thread state, protected by lock
+	 */
+	pthread_t thread;
+	int thread_running;
+	int exit;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct list_head full_list;
+	struct list_head free_list;
+	unsigned int nr_chunks;
 };
 
 struct io_piece {
@@ -50,34 +127,31 @@ struct io_piece {
 	unsigned long long offset;
 	unsigned int len;
 	enum fio_ddir ddir;
+	unsigned long long delay;
 };
 
 /*
- * The io unit
+ * Files named in a version 2 iolog, and the job file each one maps to
  */
-struct io_u {
-	union {
-#ifdef FIO_HAVE_LIBAIO
-		struct iocb iocb;
-#endif
-#ifdef FIO_HAVE_POSIXAIO
-		struct aiocb aiocb;
-#endif
-#ifdef FIO_HAVE_SGIO
-		struct sg_io_hdr hdr;
-#endif
-	};
-	struct timeval start_time;
-	struct timeval issue_time;
+struct iolog_file {
+	char *file_name;
+	struct fio_file *file;
+};
 
+/*
+ * The io unit. The fields every io touches come first, so they share the
+ * first cache lines. The engine specific parts are only touched by the
+ * engine that owns them, they go last.
+ */
+struct io_u {
 	void *buf;
 	unsigned int buflen;
-	unsigned long long offset;
-
 	unsigned int resid;
-	unsigned int error;
+	unsigned long long offset;
+	struct fio_file *file;
 
 	enum fio_ddir ddir;
+	unsigned int error;
 
 	/*
 	 * io engine private data
@@ -87,10 +161,26 @@ struct io_u {
 		unsigned int seen;
 	};
 
-	struct fio_file *file;
+	struct timespec start_time;
+	struct timespec issue_time;
 
+	/*
+	 * for the verify_async lists
+	 */
 	struct list_head list;
-};
+
+	union {
+#ifdef FIO_HAVE_LIBAIO
+		struct iocb iocb;
+#endif
+#ifdef FIO_HAVE_POSIXAIO
+		struct aiocb aiocb;
+#endif
+#ifdef FIO_HAVE_SGIO
+		struct sg_io_hdr hdr;
+#endif
+	};
+} __attribute__((aligned(FIO_CACHELINE)));
 
 #define FIO_HDR_MAGIC	0xf00baaef
 
@@ -98,6 +188,8 @@ enum {
 	VERIFY_NONE = 0,
 	VERIFY_MD5,
 	VERIFY_CRC32,
+	VERIFY_CRC32C,
+	VERIFY_XXHASH,
 };
 
 struct verify_header {
@@ -107,6 +199,8 @@ struct verify_header {
 	union {
 		char md5_digest[MD5_HASH_WORDS * 4];
 		unsigned long crc32;
+		uint32_t crc32c;
+		uint64_t xxhash;
 	};
 };
 
@@ -128,6 +222,43 @@ enum fio_memtype {
 	MEM_MMAPHUGE,	/* memory mapped huge file */
 };
 
+/*
+ * Inter-arrival times of the open loop rate control
+ */
+enum fio_rate_process {
+	RATE_PROCESS_LINEAR = 0,	/* evenly spaced */
+	RATE_PROCESS_POISSON,		/* exponentially distributed */
+};
+
+/*
+ * What steadystate= looks at. The metric is iops or bandwidth, and either
+ * its deviation from the mean or the slope over the window has to stay
+ * under the limit, which is absolute or a percentage of the mean.
+ */
+enum {
+	SS_IOPS		= 1 << 0,
+	SS_BW		= 1 << 1,
+	SS_SLOPE	= 1 << 2,
+	SS_PCT		= 1 << 3,
+};
+
+/*
+ * What to write to files that are laid out before the job runs
+ */
+enum fio_layout_fill {
+	LAYOUT_FILL_ZERO = 0,	/* zeroes, the default */
+	LAYOUT_FILL_NONE,	/* allocate the blocks, don't write them */
+	LAYOUT_FILL_RANDOM,	/* random data */
+};
+
+/*
+ * How random offsets are generated
+ */
+enum fio_rand_gen {
+	FIO_RAND_GEN_LFSR = 0,	/* full period lfsr, each block once */
+	FIO_RAND_GEN_RAND,	/* random draws checked against the map */
+};
+
 /*
  * The type of object we are working on
  */
@@ -160,10 +291,26 @@ struct fio_file {
 	unsigned long long last_pos;
 	unsigned long long last_completed_pos;
 
-	unsigned long *file_map;
-	unsigned int num_maps;
+	struct axmap *file_map;
+
+	/*
+	 * random block generator, visits each block once per loop
+	 */
+	struct fio_lfsr lfsr;
+
+	/*
+	 * range written through ->mmap since the last msync
+	 */
+	unsigned long long mmap_dirty_start;
+	unsigned long long mmap_dirty_end;
 
 	unsigned int unlink;
+
+	/*
+	 * if the file is shared with an earlier job, the thread_number of
+	 * the job that lays it out
+	 */
+	unsigned int layout_owner;
 };
 
 /*
@@ -198,9 +345,13 @@ struct thread_data {
 	unsigned int invalidate_cache;
 	unsigned int create_serialize;
 	unsigned int create_fsync;
+	unsigned int fallocate;
+	unsigned int layout_threads;
+	enum fio_layout_fill layout_fill;
 	unsigned int end_fsync;
 	unsigned int sync_io;
 	unsigned int verify;
+	unsigned int verify_async;
 	unsigned int use_thread;
 	unsigned int unlink;
 	unsigned int do_disk_util;
@@ -209,7 +360,13 @@ struct thread_data {
 	unsigned int write_lat_log;
 	unsigned int write_bw_log;
 	unsigned int norandommap;
+	enum fio_rand_gen random_generator;
+	enum fio_log_format log_format;
 	unsigned int bs_unaligned;
+	unsigned int sqthread_poll;
+	unsigned int threadpool_workers;
+	unsigned int hipri;
+	unsigned int nowait;
 
 	unsigned int bs[2];
 	unsigned int min_bs[2];
@@ -220,6 +377,7 @@ struct thread_data {
 	unsigned int fsync_blocks;
 	unsigned int start_delay;
 	unsigned long timeout;
+	unsigned long ramp_time;
 	unsigned int overwrite;
 	unsigned int bw_avg_time;
 	unsigned int loops;
@@ -228,10 +386,19 @@ struct thread_data {
 	enum fio_memtype mem_type;
 	char *mmapfile;
 	int mmapfd;
+	unsigned int mmap_hugepage;
+	unsigned int mmap_nontemporal;
 	unsigned int stonewall;
 	unsigned int numjobs;
 	unsigned int iodepth;
+	unsigned int iodepth_batch;
+	unsigned int iodepth_batch_complete;
+	unsigned int iodepth_batch_complete_max;
 	os_cpu_mask_t cpumask;
+	unsigned long numa_cpunodes;
+	unsigned int numa_cpunodes_auto;
+	unsigned int numa_mem_mode;
+	unsigned long numa_memnodes;
 	unsigned int iolog;
 	unsigned int read_iolog;
 	unsigned int rwmixcycle;
@@ -243,12 +410,25 @@ struct thread_data {
 	char *write_iolog_file;
 	void *iolog_buf;
 	FILE *iolog_f;
+	unsigned int replay_no_stall;
+	unsigned int replay_time_scale;
 
 	char *sysfs_root;
 	char *ioscheduler;
 
 	os_random_state_t bsrange_state;
-	os_random_state_t verify_state;
+	struct frand_state verify_state;
+
+	/*
+	 * write buffer contents
+	 */
+	unsigned int refill_buffers;
+	unsigned int compress_percentage;
+	unsigned int compress_chunk;
+	unsigned int dedupe_percentage;
+	struct frand_state buf_state;
+	struct frand_state buf_state_prev;
+	struct frand_state dedupe_state;
 
 	int shm_id;
 
@@ -259,11 +439,17 @@ struct thread_data {
 	struct ioengine_ops *io_ops;
 
 	/*
-	 * Current IO depth and list of free and busy io_u's.
+	 * Current IO depth, and the io_u's. They are allocated in one go,
+	 * the free ones are on a stack of indices and the ones that are out
+	 * with the io engine are marked in a bitmap.
 	 */
 	unsigned int cur_depth;
-	struct list_head io_u_freelist;
-	struct list_head io_u_busylist;
+	unsigned int io_u_queued;
+	struct io_u *io_us;
+	unsigned int io_u_nr;
+	unsigned int *io_u_free;
+	unsigned int io_u_nr_free;
+	unsigned long *io_u_busy;
 
 	/*
 	 * Rate state
@@ -271,10 +457,24 @@ struct thread_data {
 	unsigned int rate;
 	unsigned int ratemin;
 	unsigned int ratecycle;
-	unsigned long rate_usec_cycle;
+	unsigned long rate_usec_cycle[2];
 	long rate_pending_usleep;
 	unsigned long rate_bytes;
-	struct timeval lastrate;
+	struct timespec lastrate;
+
+	/*
+	 * Open loop rate state. Arrivals are in nsecs since rate_start.
+	 */
+	unsigned int rate_iops[2];
+	unsigned int rate_bw[2];
+	unsigned int rate_process;
+	unsigned int rate_spin;
+	unsigned int rate_open;
+	enum fio_ddir rate_ddir;
+	unsigned long long rate_next[2];
+	unsigned long long rate_due;
+	struct timespec rate_start;
+	struct frand_state rate_state;
 
 	unsigned long runtime[2];		/* msec */
 	unsigned long long io_size;
@@ -286,13 +486,58 @@ struct thread_data {
 	unsigned long long io_bytes[2];
 	unsigned long long zone_bytes;
 	unsigned long long this_io_bytes[2];
-	volatile int mutex;
+
+	/*
+	 * Startup. Jobs wait at the start gate (a pipe, see run_threads())
+	 * once set up. files_ready tells jobs sharing our files that they are
+	 * laid out.
+	 */
+	int start_gate;
+	volatile int files_ready;
+	unsigned long startup_msec;
+	unsigned long first_io_msec;
+	unsigned int first_io_done;
+
+	/*
+	 * Nothing is accounted until ramp_time has passed. ramp_msec is when
+	 * it actually ended, ramp_bytes what was done up to there.
+	 */
+	unsigned int ramp_time_over;
+	unsigned long ramp_msec;
+	unsigned long long ramp_bytes;
+
+	/*
+	 * Steady state detection. A sample of the metric is taken every
+	 * second in to a ring of ss_dur entries, the job ends once all of
+	 * them are within ss_limit.
+	 */
+	unsigned int ss_metric;
+	double ss_limit;
+	unsigned long ss_dur;
+	double *ss_samples;
+	unsigned int ss_head;
+	unsigned int ss_nr;
+	unsigned long long ss_last_bytes;
+	unsigned long long ss_last_blocks;
+	struct timespec ss_time;
+	unsigned int ss_attained;
+	unsigned long ss_msec;
 
 	/*
 	 * State for random io, a bitmap of blocks done vs not done
 	 */
 	os_random_state_t random_state;
 
+	/*
+	 * Skewed file and offset selection
+	 */
+	struct fio_dist random_dist;
+	struct fio_dist file_dist;
+	char *file_weights;
+	struct fio_alias offset_alias;
+	struct fio_alias file_alias;
+	struct frand_state dist_state;
+
 	/*
 	 * CPU "io" cycle burner
 	 */
@@ -305,17 +550,21 @@ struct thread_data {
 	struct io_stat clat_stat[2];		/* completion latency */
 	struct io_stat slat_stat[2];		/* submission latency */
 	struct io_stat bw_stat[2];		/* bandwidth stats */
+	unsigned int clat_plat[2][FIO_IO_U_PLAT_NR];	/* clat histogram */
+	unsigned int slat_plat[2][FIO_IO_U_PLAT_NR];	/* slat histogram */
+	struct io_snapshot snap;		/* for --status-interval */
+	struct timespec snap_time;
 
 	unsigned long long stat_io_bytes[2];
-	struct timeval stat_sample_time[2];
+	struct timespec stat_sample_time[2];
 
 	struct io_log *slat_log;
 	struct io_log *clat_log;
 	struct io_log *bw_log;
 
-	struct timeval start;	/* start of this loop */
-	struct timeval epoch;	/* time job was started */
-	struct timeval end_time;/* time job ended */
+	struct timespec start;	/* start of this loop */
+	struct timespec epoch;	/* time job was started */
+	struct timespec end_time;/* time job ended */
 
 	/*
 	 * fio system usage accounting
@@ -330,7 +579,7 @@ struct thread_data {
 	 * read/write mixed workload state
 	 */
 	os_random_state_t rwmix_state;
-	struct timeval rwmix_switch;
+	struct timespec rwmix_switch;
 	enum fio_ddir rwmix_ddir;
 
 	/*
@@ -343,7 +592,31 @@ struct thread_data {
 	 * IO historic logs
 	 */
 	struct list_head io_hist_list;
-	struct list_head io_log_list;
+
+	/*
+	 * verify offload to verify_async threads, protected by verify_lock
+	 */
+	pthread_t *verify_threads;
+	unsigned int nr_verify_threads;
+	pthread_mutex_t verify_lock;
+	pthread_cond_t verify_cond;
+	struct list_head verify_list;
+	struct list_head verify_done_list;
+	unsigned int verify_held;
+	int verify_exit;
+	int verify_error;
+
+	/*
+	 * iolog replay state, entries are parsed as they are needed
+	 */
+	unsigned int iolog_version;
+	struct iolog_file *iolog_files;
+	unsigned int iolog_nr_files;
+	struct io_piece iolog_next;
+	unsigned int iolog_next_valid;
+	unsigned int iolog_started;
+	unsigned long long iolog_first;
+	struct timespec iolog_start;
 };
 
 #define __td_verror(td, err, msg)					\
@@ -362,6 +635,7 @@ extern int thread_number;
 extern int shm_id;
 extern int groupid;
 extern int terse_output;
+extern unsigned int status_interval;
 extern FILE *f_out;
 extern FILE *f_err;
 extern int temp_stall_ts;
@@ -373,10 +647,7 @@ extern struct thread_data *threads;
 #define td_write(td)		((td)->ddir == DDIR_WRITE)
 #define td_rw(td)		((td)->iomix != 0)
 
-#define BLOCKS_PER_MAP		(8 * sizeof(long))
 #define TO_MAP_BLOCK(td, f, b)	((b) - ((f)->file_offset / (td)->rw_min_bs))
-#define RAND_MAP_IDX(td, f, b)	(TO_MAP_BLOCK(td, f, b) / BLOCKS_PER_MAP)
-#define RAND_MAP_BIT(td, f, b)	(TO_MAP_BLOCK(td, f, b) & (BLOCKS_PER_MAP - 1))
 
 #define MAX_JOBS	(1024)
 
@@ -412,7 +683,7 @@ struct disk_util {
 	struct disk_util_stat last_dus;
 
 	unsigned long msec;
-	struct timeval time;
+	struct timespec time;
 };
 
 struct io_completion_data {
@@ -420,10 +691,11 @@ struct io_completion_data {
 
 	int error;			/* output */
 	unsigned long bytes_done[2];	/* output */
-	struct timeval time;		/* output */
+	struct timespec time;		/* output */
 };
 
 #define DISK_UTIL_MSEC	(250)
+#define JOB_START_TIMEOUT	(5 * 1000)
 
 #ifndef min
 #define min(a, b)	((a) < (b) ? (a) : (b))
@@ -435,42 +707,70 @@ struct io_completion_data {
 /*
  * Log exports
  */
-extern int read_iolog_get(struct thread_data *, struct io_u *);
+extern int read_iolog_get(struct thread_data *, struct fio_file *, struct io_u *);
+extern unsigned long iolog_delay(struct thread_data *);
 extern void write_iolog_put(struct thread_data *, struct io_u *);
 extern int init_iolog(struct thread_data *td);
 extern void log_io_piece(struct thread_data *, struct io_u *);
 extern void prune_io_piece_log(struct thread_data *);
 extern void write_iolog_close(struct thread_data *);
+extern void read_iolog_close(struct thread_data *);
 
 /*
  * Logging
  */
-extern void add_clat_sample(struct thread_data *, enum fio_ddir, unsigned long);
-extern void add_slat_sample(struct thread_data *, enum fio_ddir, unsigned long);
-extern void add_bw_sample(struct thread_data *, enum fio_ddir, struct timeval *);
+extern void add_clat_sample(struct thread_data *, enum fio_ddir, unsigned long long);
+extern void add_slat_sample(struct thread_data *, enum fio_ddir, unsigned long long);
+extern void add_bw_sample(struct thread_data *, enum fio_ddir, struct timespec *);
 extern void show_run_stats(void);
+extern void update_io_snapshot(struct thread_data *, struct timespec *);
+extern void reset_io_stats(struct thread_data *);
+extern int steadystate_init(struct thread_data *);
+extern int steadystate_check(struct thread_data *, struct timespec *);
+extern void init_interval_stats(void);
+extern void show_interval_stats(void);
 extern void init_disk_util(struct thread_data *);
 extern void update_rusage_stat(struct thread_data *);
 extern void update_io_ticks(void);
 extern void disk_util_timer_arm(void);
-extern void setup_log(struct io_log **);
-extern void finish_log(struct thread_data *, struct io_log *, const char *);
+extern int setup_log(struct thread_data *, struct io_log **, const char *);
+extern void flush_log_chunk(struct io_log *);
+extern void finish_log(struct io_log *);
+extern int log_to_text(const char *);
 extern int setup_rate(struct thread_data *);
 
 /*
  * Time functions
  */
-extern unsigned long utime_since(struct timeval *, struct timeval *);
-extern unsigned long utime_since_now(struct timeval *);
-extern unsigned long mtime_since(struct timeval *, struct timeval *);
-extern unsigned long mtime_since_now(struct timeval *);
-extern unsigned long time_since_now(struct timeval *);
+enum fio_cs {
+	CS_GTOD = 1,		/* gettimeofday() */
+	CS_CGETTIME,		/* clock_gettime(CLOCK_MONOTONIC) */
+	CS_CPUCLOCK,		/* calibrated cpu cycle counter */
+};
+
+extern enum fio_cs fio_clock_source;
+extern unsigned long long ntime_since(struct timespec *, struct timespec *);
+extern unsigned long long ntime_since_now(struct timespec *);
+extern unsigned long utime_since(struct timespec *, struct timespec *);
+extern unsigned long utime_since_now(struct timespec *);
+extern unsigned long mtime_since(struct timespec *, struct timespec *);
+extern unsigned long mtime_since_now(struct timespec *);
+extern unsigned long time_since_now(struct timespec *);
+extern unsigned long mtime_since_tv(struct timeval *, struct timeval *);
 extern unsigned long mtime_since_genesis(void);
 extern void __usec_sleep(unsigned int);
 extern void usec_sleep(struct thread_data *, unsigned long);
 extern void rate_throttle(struct thread_data *, unsigned long, unsigned int, int);
-extern void fill_start_time(struct timeval *);
-extern void fio_gettime(struct timeval *, void *);
+extern void rate_open_init(struct thread_data *);
+extern unsigned long long rate_open_next(struct thread_data *);
+extern void rate_open_arrival(struct thread_data *, struct io_u *);
+extern void rate_open_sleep(struct thread_data *, unsigned long long);
+extern void fill_start_time(struct timespec *);
+extern void fio_gettime(struct timespec *, void *);
+extern int fio_clock_init(void);
+extern void fio_clock_test(void);
+extern int fio_set_clocksource(const char *);
+extern void fio_time_init(void);
 
 /*
  * Init functions
@@ -483,6 +783,7 @@ extern int init_random_state(struct thread_data *);
  */
 extern void close_files(struct thread_data *);
 extern int setup_files(struct thread_data *);
+extern void mark_shared_files(void);
 extern int open_files(struct thread_data *);
 extern int file_invalidate_cache(struct thread_data *, struct fio_file *);
 
@@ -490,6 +791,7 @@ extern int file_invalidate_cache(struct thread_data *, struct fio_file *);
  * ETA/status stuff
  */
 extern void print_thread_status(void);
+extern void eta_to_str(char *, int);
 extern void print_status_init(int);
 
 /*
@@ -501,6 +803,7 @@ extern void print_status_init(int);
 enum {
 	TD_NOT_CREATED = 0,
 	TD_CREATED,
+	TD_SETTING_UP,
 	TD_INITIALIZED,
 	TD_RUNNING,
 	TD_VERIFYING,
@@ -515,6 +818,32 @@ enum {
 extern void populate_verify_io_u(struct thread_data *, struct io_u *);
 extern int get_next_verify(struct thread_data *td, struct io_u *);
 extern int do_io_u_verify(struct thread_data *, struct io_u **);
+extern int verify_async_init(struct thread_data *);
+extern void verify_async_exit(struct thread_data *);
+extern void verify_io_u_async(struct thread_data *, struct io_u *);
+extern int verify_async_reap(struct thread_data *, int);
+extern int fio_crctest(const char *);
+
+/*
+ * NUMA placement
+ */
+enum fio_numa_mem {
+	NUMA_MEM_NONE = 0,
+	NUMA_MEM_DEFAULT,
+	NUMA_MEM_LOCAL,
+	NUMA_MEM_PREFER,
+	NUMA_MEM_BIND,
+	NUMA_MEM_INTERLEAVE,
+};
+
+#ifdef FIO_HAVE_NUMA
+extern int fio_numa_parse_nodes(const char *, unsigned long *);
+extern int fio_numa_setup(struct thread_data *);
+extern void fio_numa_spread(void);
+#else
+#define fio_numa_setup(td)	(0)
+#define fio_numa_spread()	do { } while (0)
+#endif
 
 /*
  * Memory helpers
@@ -527,10 +856,64 @@ extern void free_io_mem(struct thread_data *);
 /*
  * io unit handling
  */
-#define queue_full(td)	list_empty(&(td)->io_u_freelist)
+#define queue_full(td)	(!(td)->io_u_nr_free)
+
+/*
+ * io_u's out with the io engine. verify_async ones are held by fio itself.
+ */
+#define io_u_in_flight(td)	((td)->cur_depth - (td)->verify_held)
+
+static inline unsigned int io_u_index(struct thread_data *td,
+				      struct io_u *io_u)
+{
+	return io_u - td->io_us;
+}
+
+static inline void io_u_set_busy(struct thread_data *td, struct io_u *io_u)
+{
+	unsigned int i = io_u_index(td, io_u);
+
+	td->io_u_busy[i / BITS_PER_LONG] |= 1UL << (i & (BITS_PER_LONG - 1));
+}
+
+static inline void io_u_clear_busy(struct thread_data *td, struct io_u *io_u)
+{
+	unsigned int i = io_u_index(td, io_u);
+
+	td->io_u_busy[i / BITS_PER_LONG] &= ~(1UL << (i & (BITS_PER_LONG - 1)));
+}
+
+/*
+ * Return the first busy io_u at index *i or later, and set *i to its index
+ */
+static inline struct io_u *io_u_next_busy(struct thread_data *td,
+					  unsigned int *i)
+{
+	unsigned int word = *i / BITS_PER_LONG;
+	unsigned int nr_words = (td->io_u_nr + BITS_PER_LONG - 1) / BITS_PER_LONG;
+	unsigned long bits;
+
+	if (*i >= td->io_u_nr)
+		return NULL;
+
+	bits = td->io_u_busy[word] & (~0UL << (*i & (BITS_PER_LONG - 1)));
+	while (!bits) {
+		if (++word >= nr_words)
+			return NULL;
+		bits = td->io_u_busy[word];
+	}
+
+	*i = word * BITS_PER_LONG + ffz(~bits);
+	return &td->io_us[*i];
+}
+
+#define for_each_busy_io_u(td, io_u, i)	\
+	for ((i) = 0; ((io_u) = io_u_next_busy((td), &(i))) != NULL; (i)++)
 extern struct io_u *__get_io_u(struct thread_data *);
 extern struct io_u *get_io_u(struct thread_data *, struct fio_file *);
 extern void put_io_u(struct thread_data *, struct io_u *);
+extern void reset_file_io_state(struct thread_data *, struct fio_file *);
+extern void fill_io_buffer(struct thread_data *, void *, unsigned int);
 extern void ios_completed(struct thread_data *, struct io_completion_data *);
 extern void io_completed(struct thread_data *, struct io_u *, struct io_completion_data *);
 
@@ -540,33 +923,10 @@ extern void io_completed(struct thread_data *, struct io_u *, struct io_completi
 extern int td_io_init(struct thread_data *);
 extern int td_io_prep(struct thread_data *, struct io_u *);
 extern int td_io_queue(struct thread_data *, struct io_u *);
+extern int td_io_commit(struct thread_data *);
 extern int td_io_sync(struct thread_data *, struct fio_file *);
 extern int td_io_getevents(struct thread_data *, int, int, struct timespec *);
 
-/*
- * This is a pretty crappy semaphore implementation, but with the use that fio
- * has (just signalling start/go conditions), it doesn't have to be better.
- * Naturally this would not work for any type of contended semaphore or
- * for real locking.
- */
-static inline void fio_sem_init(volatile int *sem, int val)
-{
-	*sem = val;
-}
-
-static inline void fio_sem_down(volatile int *sem)
-{
-	while (*sem == 0)
-		usleep(10000);
-
-	(*sem)--;
-}
-
-static inline void fio_sem_up(volatile int *sem)
-{
-	(*sem)++;
-}
-
 /*
  * If logging output to a file, stderr should go to both stderr and f_err
  */
@@ -585,6 +945,7 @@ struct ioengine_ops {
 	int (*init)(struct thread_data *);
 	int (*prep)(struct thread_data *, struct io_u *);
 	int (*queue)(struct thread_data *, struct io_u *);
+	int (*commit)(struct thread_data *);
 	int (*getevents)(struct thread_data *, int, int, struct timespec *);
 	struct io_u *(*event)(struct thread_data *, int);
 	int (*cancel)(struct thread_data *, struct io_u *);
@@ -593,7 +954,7 @@ struct ioengine_ops {
 	void *dlhandle;
 };
 
-#define FIO_IOOPS_VERSION	3
+#define FIO_IOOPS_VERSION	4
 
 extern struct ioengine_ops *load_ioengine(struct thread_data *, const char *);
 extern int register_ioengine(struct ioengine_ops *);
@@ -3,6 +3,7 @@
  */
 
 #include <unistd.h>
+#include <string.h>
 #include <sys/time.h>
 
 #include "fio.h"
@@ -10,7 +11,8 @@
 
 #include "hash.h"
 
-static int clock_gettime_works = 1;
+enum fio_cs fio_clock_source = CS_CGETTIME;
+static int clock_source_set;
 
 #ifdef FIO_DEBUG_TIME
 
@@ -101,38 +103,206 @@ static void fio_init gtod_init(void)
 
 #endif /* FIO_DEBUG_TIME */
 
+#ifdef ARCH_HAVE_CPU_CLOCK
+/*
+ * cpu clock to nsec conversion, ns = (cycles * clock_mult) >> CLOCK_SHIFT.
+ * The cycle count is taken relative to the calibration point, and added
+ * to the CLOCK_MONOTONIC time sampled there, so all sources share a base.
+ */
+#define CLOCK_SHIFT	24
+#define CLOCK_MASK	((1ULL << CLOCK_SHIFT) - 1)
+#define CALIBRATE_MSEC	25
+
+static unsigned long long clock_mult;
+static unsigned long long cycles_start;
+static struct timespec cycles_base;
+static int cpu_clock_invariant;
+
+static void get_cpu_time(struct timespec *ts)
+{
+	unsigned long long t, nsecs;
+
+	t = get_cpu_clock() - cycles_start;
+	nsecs = (t >> CLOCK_SHIFT) * clock_mult;
+	nsecs += ((t & CLOCK_MASK) * clock_mult) >> CLOCK_SHIFT;
+	nsecs += cycles_base.tv_nsec;
+
+	ts->tv_sec = cycles_base.tv_sec + nsecs / 1000000000ULL;
+	ts->tv_nsec = nsecs % 1000000000ULL;
+}
+
+/*
+ * Time the cpu clock against CLOCK_MONOTONIC for a little while
+ */
+static int calibrate_cpu_clock(void)
+{
+	struct timespec s, e;
+	unsigned long long c_s, c_e, nsecs;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &s) < 0)
+		return 1;
+
+	c_s = get_cpu_clock();
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &e);
+		c_e = get_cpu_clock();
+		nsecs = (e.tv_sec - s.tv_sec) * 1000000000ULL;
+		nsecs += e.tv_nsec - s.tv_nsec;
+	} while (nsecs < CALIBRATE_MSEC * 1000000ULL);
+
+	if (c_e <= c_s)
+		return 1;
+
+	clock_mult = (nsecs << CLOCK_SHIFT) / (c_e - c_s);
+	if (!clock_mult)
+		return 1;
+
+	cycles_start = c_e;
+	cycles_base = e;
+	return 0;
+}
+#endif
+
 #ifdef FIO_DEBUG_TIME
-void fio_gettime(struct timeval *tp, void *caller)
+void fio_gettime(struct timespec *ts, void *caller)
 #else
-void fio_gettime(struct timeval *tp, void fio_unused *caller)
+void fio_gettime(struct timespec *ts, void fio_unused *caller)
 #endif
 {
+	struct timeval tv;
+
 #ifdef FIO_DEBUG_TIME
 	if (!caller)
 		caller = __builtin_return_address(0);
 
 	gtod_log_caller(caller);
 #endif
-repeat:
-	if (!clock_gettime_works)
-		gettimeofday(tp, NULL);
+	switch (fio_clock_source) {
+#ifdef ARCH_HAVE_CPU_CLOCK
+	case CS_CPUCLOCK:
+		get_cpu_time(ts);
+		break;
+#endif
+	case CS_CGETTIME:
+		if (!clock_gettime(CLOCK_MONOTONIC, ts))
+			break;
+		fio_clock_source = CS_GTOD;
+		/* fall through */
+	default:
+		gettimeofday(&tv, NULL);
+		ts->tv_sec = tv.tv_sec;
+		ts->tv_nsec = tv.tv_usec * 1000;
+		break;
+	}
+}
+
+int fio_set_clocksource(const char *str)
+{
+	if (!strcmp(str, "gettimeofday"))
+		fio_clock_source = CS_GTOD;
+	else if (!strcmp(str, "clock_gettime"))
+		fio_clock_source = CS_CGETTIME;
+#ifdef ARCH_HAVE_CPU_CLOCK
+	else if (!strcmp(str, "cpu"))
+		fio_clock_source = CS_CPUCLOCK;
+#endif
 	else {
-		struct timespec ts;
+		log_err("fio: clocksource: gettimeofday, clock_gettime, cpu\n");
+		return 1;
+	}
+
+	clock_source_set = 1;
+	return 0;
+}
+
+/*
+ * Pick the clock source. Unless one was asked for, prefer the cpu clock if
+ * it's invariant, then clock_gettime(), then gettimeofday().
+ */
+int fio_clock_init(void)
+{
+	struct timespec ts;
+	int cgettime_works;
 
-		if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
-			clock_gettime_works = 0;
-			goto repeat;
+	cgettime_works = !clock_getres(CLOCK_MONOTONIC, &ts);
+
+#ifdef ARCH_HAVE_CPU_CLOCK
+	cpu_clock_invariant = arch_cpu_clock_invariant();
+	if (!cgettime_works || calibrate_cpu_clock()) {
+		if (fio_clock_source == CS_CPUCLOCK) {
+			log_err("fio: cpu clock failed to calibrate\n");
+			return 1;
 		}
+		cpu_clock_invariant = 0;
+	}
+
+	if (clock_source_set) {
+		if (fio_clock_source == CS_CPUCLOCK && !cpu_clock_invariant)
+			log_err("fio: warning: cpu clock isn't invariant\n");
+		return 0;
+	}
+
+	if (cpu_clock_invariant) {
+		fio_clock_source = CS_CPUCLOCK;
+		return 0;
+	}
+#else
+	if (clock_source_set)
+		return 0;
+#endif
+
+	if (cgettime_works)
+		fio_clock_source = CS_CGETTIME;
+	else
+		fio_clock_source = CS_GTOD;
+
+	return 0;
+}
+
+/*
+ * Time how long a clock read takes for each source, and the smallest step
+ * seen between two reads.
+ */
+#define CLOCK_TEST_LOOPS	1000000
 
-		tp->tv_sec = ts.tv_sec;
-		tp->tv_usec = ts.tv_nsec / 1000;
+static void clock_test_source(enum fio_cs cs, const char *name)
+{
+	struct timespec s, e, prev, cur;
+	unsigned long long step, min_step = -1ULL;
+	unsigned int i;
+
+	fio_clock_source = cs;
+
+	fio_gettime(&s, NULL);
+	prev = s;
+	for (i = 0; i < CLOCK_TEST_LOOPS; i++) {
+		fio_gettime(&cur, NULL);
+		step = ntime_since(&prev, &cur);
+		if (step && step < min_step)
+			min_step = step;
+		prev = cur;
 	}
+	fio_gettime(&e, NULL);
+
+	printf("%-14s: %6.2f nsec/read, resolution %llu nsec\n", name,
+		(double) ntime_since(&s, &e) / CLOCK_TEST_LOOPS, min_step);
 }
 
-static void fio_init check_clock(void)
+void fio_clock_test(void)
 {
-	struct timespec ts;
+	enum fio_cs cs = fio_clock_source;
+
+#ifdef ARCH_HAVE_CPU_CLOCK
+	if (clock_mult) {
+		printf("cpu clock     : %.2f MHz, %sinvariant\n",
+			(double) (1000ULL << CLOCK_SHIFT) / clock_mult,
+			cpu_clock_invariant ? "" : "not ");
+		clock_test_source(CS_CPUCLOCK, "cpu");
+	} else
+		printf("cpu clock     : failed to calibrate\n");
+#endif
+	clock_test_source(CS_CGETTIME, "clock_gettime");
+	clock_test_source(CS_GTOD, "gettimeofday");
 
-	if (clock_getres(CLOCK_MONOTONIC, &ts) < 0)
-		clock_gettime_works = 0;
+	fio_clock_source = cs;
 }
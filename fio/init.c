@@ -24,6 +24,7 @@
 #define DEF_BS			(4096)
 #define DEF_TIMEOUT		(0)
 #define DEF_RATE_CYCLE		(1000)
+#define DEF_RATE_SPIN		(50)
 #define DEF_ODIRECT		(1)
 #define DEF_IO_ENGINE		(FIO_SYNCIO)
 #define DEF_IO_ENGINE_NAME	"sync"
@@ -34,8 +35,9 @@
 #define DEF_SYNCIO		(0)
 #define DEF_RANDSEED		(0xb1899bedUL)
 #define DEF_BWAVGTIME		(500)
-#define DEF_CREATE_SER		(1)
+#define DEF_CREATE_SER		(0)
 #define DEF_CREATE_FSYNC	(1)
+#define DEF_FALLOCATE		(1)
 #define DEF_LOOPS		(1)
 #define DEF_VERIFY		(0)
 #define DEF_STONEWALL		(0)
@@ -53,6 +55,10 @@
 #define DEF_WRITE_LAT_LOG	(0)
 #define DEF_NO_RAND_MAP		(0)
 #define DEF_HUGEPAGE_SIZE	FIO_HUGE_PAGE
+#define DEF_REPLAY_TIME_SCALE	(100)
+#define DEF_COMPRESS_CHUNK	(512)
+#define DEF_DIST_BUCKETS	(64 * 1024)
+#define DEF_SS_DURATION		(60)
 
 #define td_var_offset(var)	((size_t) &((struct thread_data *)0)->var)
 
@@ -60,6 +66,10 @@ static int str_rw_cb(void *, const char *);
 static int str_ioengine_cb(void *, const char *);
 static int str_mem_cb(void *, const char *);
 static int str_verify_cb(void *, const char *);
+static int str_random_generator_cb(void *, const char *);
+static int str_random_distribution_cb(void *, const char *);
+static int str_file_service_cb(void *, const char *);
+static int str_log_format_cb(void *, const char *);
 static int str_lockmem_cb(void *, unsigned long *);
 #ifdef FIO_HAVE_IOPRIO
 static int str_prio_cb(void *, unsigned int *);
@@ -67,6 +77,13 @@ static int str_prioclass_cb(void *, unsigned int *);
 #endif
 static int str_exitall_cb(void);
 static int str_cpumask_cb(void *, unsigned int *);
+#ifdef FIO_HAVE_NUMA
+static int str_numa_cpunodes_cb(void *, const char *);
+static int str_numa_mpol_cb(void *, const char *);
+#endif
+static int str_layout_fill_cb(void *, const char *);
+static int str_rate_process_cb(void *, const char *);
+static int str_steadystate_cb(void *, const char *);
 
 /*
  * Map of job/command line options
@@ -107,6 +124,11 @@ static struct fio_option options[] = {
 		.type	= FIO_OPT_STR,
 		.cb	= str_verify_cb,
 	},
+	{
+		.name	= "verify_async",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(verify_async),
+	},
 	{
 		.name	= "write_iolog",
 		.type	= FIO_OPT_STR_STORE,
@@ -117,6 +139,16 @@ static struct fio_option options[] = {
 		.type	= FIO_OPT_STR_STORE,
 		.off1	= td_var_offset(read_iolog_file),
 	},
+	{
+		.name	= "replay_no_stall",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(replay_no_stall),
+	},
+	{
+		.name	= "replay_time_scale",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(replay_time_scale),
+	},
 	{
 		.name	= "exec_prerun",
 		.type	= FIO_OPT_STR_STORE,
@@ -183,6 +215,21 @@ static struct fio_option options[] = {
 		.type	= FIO_OPT_INT,
 		.off1	= td_var_offset(iodepth),
 	},
+	{
+		.name	= "iodepth_batch",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(iodepth_batch),
+	},
+	{
+		.name	= "iodepth_batch_complete",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(iodepth_batch_complete),
+	},
+	{
+		.name	= "iodepth_batch_complete_max",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(iodepth_batch_complete_max),
+	},
 	{
 		.name	= "fsync",
 		.type	= FIO_OPT_INT,
@@ -242,6 +289,28 @@ static struct fio_option options[] = {
 		.type	= FIO_OPT_INT,
 		.off1	= td_var_offset(ratecycle)
 	},
+	{
+		.name	= "rate_iops",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(rate_iops[DDIR_READ]),
+		.off2	= td_var_offset(rate_iops[DDIR_WRITE]),
+	},
+	{
+		.name	= "rate_bw",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(rate_bw[DDIR_READ]),
+		.off2	= td_var_offset(rate_bw[DDIR_WRITE]),
+	},
+	{
+		.name	= "rate_process",
+		.type	= FIO_OPT_STR,
+		.cb	= str_rate_process_cb,
+	},
+	{
+		.name	= "rate_spin",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(rate_spin)
+	},
 	{
 		.name	= "startdelay",
 		.type	= FIO_OPT_INT,
@@ -252,6 +321,21 @@ static struct fio_option options[] = {
 		.type	= FIO_OPT_STR_VAL_TIME,
 		.off1	= td_var_offset(timeout)
 	},
+	{
+		.name	= "ramp_time",
+		.type	= FIO_OPT_STR_VAL_TIME,
+		.off1	= td_var_offset(ramp_time)
+	},
+	{
+		.name	= "steadystate",
+		.type	= FIO_OPT_STR,
+		.cb	= str_steadystate_cb,
+	},
+	{
+		.name	= "steadystate_duration",
+		.type	= FIO_OPT_STR_VAL_TIME,
+		.off1	= td_var_offset(ss_dur)
+	},
 	{
 		.name	= "invalidate",
 		.type	= FIO_OPT_INT,
@@ -277,6 +361,21 @@ static struct fio_option options[] = {
 		.type	= FIO_OPT_INT,
 		.off1	= td_var_offset(create_fsync)
 	},
+	{
+		.name	= "fallocate",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(fallocate)
+	},
+	{
+		.name	= "layout_fill",
+		.type	= FIO_OPT_STR,
+		.cb	= str_layout_fill_cb,
+	},
+	{
+		.name	= "layout_threads",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(layout_threads)
+	},
 	{
 		.name	= "loops",
 		.type	= FIO_OPT_INT,
@@ -313,6 +412,18 @@ static struct fio_option options[] = {
 		.type	= FIO_OPT_INT,
 		.cb	= str_cpumask_cb,
 	},
+#endif
+#ifdef FIO_HAVE_NUMA
+	{
+		.name	= "numa_cpu_nodes",
+		.type	= FIO_OPT_STR,
+		.cb	= str_numa_cpunodes_cb,
+	},
+	{
+		.name	= "numa_mem_policy",
+		.type	= FIO_OPT_STR,
+		.cb	= str_numa_mpol_cb,
+	},
 #endif
 	{
 		.name	= "end_fsync",
@@ -334,6 +445,26 @@ static struct fio_option options[] = {
 		.type	= FIO_OPT_STR_SET,
 		.off1	= td_var_offset(stonewall),
 	},
+	{
+		.name	= "refill_buffers",
+		.type	= FIO_OPT_STR_SET,
+		.off1	= td_var_offset(refill_buffers),
+	},
+	{
+		.name	= "buffer_compress_percentage",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(compress_percentage),
+	},
+	{
+		.name	= "buffer_compress_chunk",
+		.type	= FIO_OPT_STR_VAL_INT,
+		.off1	= td_var_offset(compress_chunk),
+	},
+	{
+		.name	= "dedupe_percentage",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(dedupe_percentage),
+	},
 	{
 		.name	= "thread",
 		.type	= FIO_OPT_STR_SET,
@@ -354,11 +485,68 @@ static struct fio_option options[] = {
 		.type	= FIO_OPT_STR_SET,
 		.off1	= td_var_offset(norandommap),
 	},
+	{
+		.name	= "log_format",
+		.type	= FIO_OPT_STR,
+		.cb	= str_log_format_cb,
+	},
+	{
+		.name	= "random_generator",
+		.type	= FIO_OPT_STR,
+		.cb	= str_random_generator_cb,
+	},
+	{
+		.name	= "random_distribution",
+		.type	= FIO_OPT_STR,
+		.cb	= str_random_distribution_cb,
+	},
+	{
+		.name	= "file_service_type",
+		.type	= FIO_OPT_STR,
+		.cb	= str_file_service_cb,
+	},
+	{
+		.name	= "file_weights",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= td_var_offset(file_weights),
+	},
 	{
 		.name	= "bs_unaligned",
 		.type	= FIO_OPT_STR_SET,
 		.off1	= td_var_offset(bs_unaligned),
 	},
+	{
+		.name	= "sqthread_poll",
+		.type	= FIO_OPT_STR_SET,
+		.off1	= td_var_offset(sqthread_poll),
+	},
+	{
+		.name	= "threadpool_workers",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(threadpool_workers),
+	},
+#ifdef FIO_HAVE_PWRITEV2
+	{
+		.name	= "hipri",
+		.type	= FIO_OPT_STR_SET,
+		.off1	= td_var_offset(hipri),
+	},
+	{
+		.name	= "nowait",
+		.type	= FIO_OPT_STR_SET,
+		.off1	= td_var_offset(nowait),
+	},
+#endif
+	{
+		.name	= "mmap_hugepage",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(mmap_hugepage),
+	},
+	{
+		.name	= "mmap_nontemporal",
+		.type	= FIO_OPT_INT,
+		.off1	= td_var_offset(mmap_nontemporal),
+	},
 	{
 		.name	= "hugepage-size",
 		.type	= FIO_OPT_STR_VAL,
@@ -408,6 +596,31 @@ static struct option long_options[FIO_JOB_OPTS + FIO_CMD_OPTS] = {
 		.has_arg	= no_argument,
 		.val		= 'v',
 	},
+	{
+		.name		= "status-interval",
+		.has_arg	= required_argument,
+		.val		= 'i',
+	},
+	{
+		.name		= "log-to-text",
+		.has_arg	= required_argument,
+		.val		= 'L',
+	},
+	{
+		.name		= "clocksource",
+		.has_arg	= required_argument,
+		.val		= 'c',
+	},
+	{
+		.name		= "clock-test",
+		.has_arg	= no_argument,
+		.val		= 'T',
+	},
+	{
+		.name		= "crctest",
+		.has_arg	= optional_argument,
+		.val		= 'C',
+	},
 	{
 		.name		= NULL,
 	},
@@ -425,6 +638,7 @@ struct thread_data *threads = NULL;
 
 int exitall_on_terminate = 0;
 int terse_output = 0;
+unsigned int status_interval = 0;
 unsigned long long mlock_size = 0;
 FILE *f_out = NULL;
 FILE *f_err = NULL;
@@ -482,6 +696,26 @@ static void fixup_options(struct thread_data *td)
 			td->iodepth = td->nr_files;
 	}
 
+	/*
+	 * default to submitting a full queue worth of io at the time
+	 */
+	if (!td->iodepth_batch || td->iodepth_batch > td->iodepth)
+		td->iodepth_batch = td->iodepth;
+
+	/*
+	 * when the queue is full, wait for at least iodepth_batch_complete
+	 * ios and reap no more than iodepth_batch_complete_max at the time
+	 */
+	if (!td->iodepth_batch_complete)
+		td->iodepth_batch_complete = 1;
+	else if (td->iodepth_batch_complete > td->iodepth)
+		td->iodepth_batch_complete = td->iodepth;
+	if (!td->iodepth_batch_complete_max ||
+	    td->iodepth_batch_complete_max > td->iodepth)
+		td->iodepth_batch_complete_max = td->iodepth;
+	if (td->iodepth_batch_complete_max < td->iodepth_batch_complete)
+		td->iodepth_batch_complete_max = td->iodepth_batch_complete;
+
 	/*
 	 * only really works for sequential io for now, and with 1 file
 	 */
@@ -508,6 +742,22 @@ static void fixup_options(struct thread_data *td)
 	if (td_read(td) && !td_rw(td))
 		td->verify = 0;
 
+	/*
+	 * a skewed distribution hits the same blocks over and over, so it
+	 * can't work with the random map
+	 */
+	if (td->random_dist.type != FIO_DIST_NONE) {
+		if (td->verify != VERIFY_NONE) {
+			log_err("fio: random_distribution given, verify disabled\n");
+			td->verify = VERIFY_NONE;
+		}
+		td->norandommap = 1;
+	}
+	if (td->file_dist.type == FIO_DIST_WEIGHTED && !td->file_weights) {
+		log_err("fio: no file_weights given, picking files at random\n");
+		td->file_dist.type = FIO_DIST_UNIFORM;
+	}
+
 	if (td->norandommap && td->verify != VERIFY_NONE) {
 		log_err("fio: norandommap given, verify disabled\n");
 		td->verify = VERIFY_NONE;
@@ -515,6 +765,32 @@ static void fixup_options(struct thread_data *td)
 	if (td->bs_unaligned && (td->odirect || td->io_ops->flags & FIO_RAWIO))
 		log_err("fio: bs_unaligned may not work with raw io\n");
 
+	if (td->compress_percentage > 100) {
+		log_err("fio: buffer_compress_percentage capped at 100\n");
+		td->compress_percentage = 100;
+	}
+	if (td->dedupe_percentage > 100) {
+		log_err("fio: dedupe_percentage capped at 100\n");
+		td->dedupe_percentage = 100;
+	}
+	if (!td->compress_chunk)
+		td->compress_chunk = DEF_COMPRESS_CHUNK;
+
+	/*
+	 * data reduction settings only mean something if every write
+	 * gets its own contents
+	 */
+	if (td->compress_percentage || td->dedupe_percentage)
+		td->refill_buffers = 1;
+
+	/*
+	 * the window only means something with a metric to watch
+	 */
+	if (!td->ss_metric)
+		td->ss_dur = 0;
+	else if (!td->ss_dur)
+		td->ss_dur = DEF_SS_DURATION;
+
 	/*
 	 * O_DIRECT and char doesn't mix, clear that flag if necessary.
 	 */
@@ -625,11 +901,11 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num)
 		f->file_offset = td->start_offset;
 	}
 		
-	fio_sem_init(&td->mutex, 0);
+	td->start_gate = -1;
 
-	td->clat_stat[0].min_val = td->clat_stat[1].min_val = ULONG_MAX;
-	td->slat_stat[0].min_val = td->slat_stat[1].min_val = ULONG_MAX;
-	td->bw_stat[0].min_val = td->bw_stat[1].min_val = ULONG_MAX;
+	td->clat_stat[0].min_val = td->clat_stat[1].min_val = ULLONG_MAX;
+	td->slat_stat[0].min_val = td->slat_stat[1].min_val = ULLONG_MAX;
+	td->bw_stat[0].min_val = td->bw_stat[1].min_val = ULLONG_MAX;
 
 	if (td->stonewall && td->thread_number > 1)
 		groupid++;
@@ -640,11 +916,13 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num)
 		goto err;
 
 	if (td->write_lat_log) {
-		setup_log(&td->slat_log);
-		setup_log(&td->clat_log);
+		if (setup_log(td, &td->slat_log, "slat"))
+			goto err;
+		if (setup_log(td, &td->clat_log, "clat"))
+			goto err;
 	}
-	if (td->write_bw_log)
-		setup_log(&td->bw_log);
+	if (td->write_bw_log && setup_log(td, &td->bw_log, "bw"))
+		goto err;
 
 	if (!td->name)
 		td->name = strdup(jobname);
@@ -698,14 +976,94 @@ err:
 	return -1;
 }
 
+/*
+ * file_weights is a list like 4:2:1, repeated if there are more files
+ */
+static double *get_file_weights(struct thread_data *td)
+{
+	double *w, *list;
+	unsigned int i, nr = 0;
+	char *p, *end;
+
+	list = malloc(td->nr_files * sizeof(double));
+	w = malloc(td->nr_files * sizeof(double));
+	if (!list || !w)
+		goto err;
+
+	p = td->file_weights;
+	while (nr < td->nr_files) {
+		list[nr] = strtod(p, &end);
+		if (end == p || list[nr] < 0.0)
+			goto err;
+		nr++;
+		if (*end != ':')
+			break;
+		p = end + 1;
+	}
+
+	for (i = 0; i < td->nr_files; i++)
+		w[i] = list[i % nr];
+
+	free(list);
+	return w;
+err:
+	log_err("fio: bad file_weights %s\n", td->file_weights);
+	free(list);
+	free(w);
+	return NULL;
+}
+
+/*
+ * Alias tables for skewed file and offset selection. Offsets are picked
+ * from at most DEF_DIST_BUCKETS equal parts of the file, the part is then
+ * picked uniformly from.
+ */
+static int init_dist_state(struct thread_data *td, unsigned long seed)
+{
+	unsigned long long blocks, nr = DEF_DIST_BUCKETS;
+	double *weights = NULL;
+	struct fio_file *f;
+	int i, ret;
+
+	frand_seed(&td->dist_state, seed);
+
+	if (td->file_dist.type != FIO_DIST_NONE) {
+		if (td->file_dist.type == FIO_DIST_WEIGHTED) {
+			weights = get_file_weights(td);
+			if (!weights)
+				return 1;
+		}
+
+		ret = dist_alias_init(&td->file_alias, &td->file_dist, td->nr_files, weights, NULL);
+		free(weights);
+		if (ret)
+			return 1;
+	}
+
+	if (td->sequential || td->random_dist.type == FIO_DIST_NONE)
+		return 0;
+
+	for_each_file(td, f, i) {
+		blocks = f->file_size / td->rw_min_bs;
+		if (blocks < nr)
+			nr = blocks;
+	}
+
+	if (!nr)
+		nr = 1;
+
+	return dist_alias_init(&td->offset_alias, &td->random_dist, nr, NULL, &td->dist_state);
+}
+
 /*
  * Initialize the various random states we need (random io, block size ranges,
  * read/write mix, etc).
  */
 int init_random_state(struct thread_data *td)
 {
-	unsigned long seeds[4];
-	int fd, num_maps, blocks, i;
+	unsigned long seeds[8];
+	unsigned long long blocks;
+	int fd, i;
 	struct fio_file *f;
 
 	if (td->io_ops->flags & FIO_CPUIO)
@@ -726,22 +1084,39 @@ int init_random_state(struct thread_data *td)
 	close(fd);
 
 	os_random_seed(seeds[0], &td->bsrange_state);
-	os_random_seed(seeds[1], &td->verify_state);
+	frand_seed(&td->verify_state, seeds[1]);
 	os_random_seed(seeds[2], &td->rwmix_state);
+	frand_seed(&td->buf_state, seeds[4]);
+	memcpy(&td->buf_state_prev, &td->buf_state, sizeof(td->buf_state));
+	frand_seed(&td->dedupe_state, seeds[5]);
+
+	if (td->rand_repeatable)
+		seeds[3] = seeds[6] = seeds[7] = DEF_RANDSEED;
+
+	frand_seed(&td->rate_state, seeds[7]);
+
+	if (init_dist_state(td, seeds[6])) {
+		td_verror(td, EINVAL);
+		return 1;
+	}
 
 	if (td->sequential)
 		return 0;
 
-	if (td->rand_repeatable)
-		seeds[3] = DEF_RANDSEED;
-
-	if (!td->norandommap) {
+	/*
+	 * The lfsr never repeats a block, so we only need the map to catch
+	 * overlap from variable block sizes.
+	 */
+	if (!td->norandommap && (td->random_generator != FIO_RAND_GEN_LFSR ||
+	    td->max_bs[DDIR_READ] != td->rw_min_bs ||
+	    td->max_bs[DDIR_WRITE] != td->rw_min_bs)) {
 		for_each_file(td, f, i) {
 			blocks = (f->file_size + td->rw_min_bs - 1) / td->rw_min_bs;
-			num_maps = (blocks + BLOCKS_PER_MAP-1)/ BLOCKS_PER_MAP;
-			f->file_map = malloc(num_maps * sizeof(long));
-			f->num_maps = num_maps;
-			memset(f->file_map, 0, num_maps * sizeof(long));
+			f->file_map = axmap_new(blocks);
+			if (!f->file_map) {
+				td_verror(td, ENOMEM);
+				return 1;
+			}
 		}
 	}
 
@@ -749,16 +1124,16 @@ int init_random_state(struct thread_data *td)
 	return 0;
 }
 
-static void fill_cpu_mask(os_cpu_mask_t cpumask, int cpu)
+static void fill_cpu_mask(os_cpu_mask_t *cpumask, int cpu)
 {
 #ifdef FIO_HAVE_CPU_AFFINITY
 	unsigned int i;
 
-	CPU_ZERO(&cpumask);
+	CPU_ZERO(cpumask);
 
 	for (i = 0; i < sizeof(int) * 8; i++) {
 		if ((1 << i) & cpu)
-			CPU_SET(i, &cpumask);
+			CPU_SET(i, cpumask);
 	}
 #endif
 }
@@ -823,12 +1198,162 @@ static int str_verify_cb(void *data, const char *mem)
 	} else if (!strncmp(mem, "md5", 3) || !strncmp(mem, "1", 1)) {
 		td->verify = VERIFY_MD5;
 		return 0;
+	} else if (!strncmp(mem, "crc32c", 6)) {
+		td->verify = VERIFY_CRC32C;
+		return 0;
 	} else if (!strncmp(mem, "crc32", 5)) {
 		td->verify = VERIFY_CRC32;
 		return 0;
+	} else if (!strncmp(mem, "xxhash", 6)) {
+		td->verify = VERIFY_XXHASH;
+		return 0;
+	}
+
+	log_err("fio: verify types: md5, crc32, crc32c, xxhash\n");
+	return 1;
+}
+
+static int str_random_generator_cb(void *data, const char *mem)
+{
+	struct thread_data *td = data;
+
+	if (!strncmp(mem, "lfsr", 4)) {
+		td->random_generator = FIO_RAND_GEN_LFSR;
+		return 0;
+	} else if (!strncmp(mem, "rand", 4)) {
+		td->random_generator = FIO_RAND_GEN_RAND;
+		return 0;
+	}
+
+	log_err("fio: random generators: lfsr, rand\n");
+	return 1;
+}
+
+static int str_rate_process_cb(void *data, const char *mem)
+{
+	struct thread_data *td = data;
+
+	if (!strncmp(mem, "linear", 6)) {
+		td->rate_process = RATE_PROCESS_LINEAR;
+		return 0;
+	} else if (!strncmp(mem, "poisson", 7)) {
+		td->rate_process = RATE_PROCESS_POISSON;
+		return 0;
+	}
+
+	log_err("fio: rate_process types: linear, poisson\n");
+	return 1;
+}
+
+/*
+ * iops:X, iops_slope:X, bw:X or bw_slope:X, with X in iops or KiB/s, or
+ * in percent of the mean if it ends in a %
+ */
+static int str_steadystate_cb(void *data, const char *mem)
+{
+	struct thread_data *td = data;
+	unsigned int metric;
+	char *end;
+	double val;
+
+	if (!strncmp(mem, "iops", 4)) {
+		metric = SS_IOPS;
+		mem += 4;
+	} else if (!strncmp(mem, "bw", 2)) {
+		metric = SS_BW;
+		mem += 2;
+	} else
+		goto err;
+
+	if (!strncmp(mem, "_slope", 6)) {
+		metric |= SS_SLOPE;
+		mem += 6;
+	}
+
+	if (*mem != ':')
+		goto err;
+	mem++;
+
+	val = strtod(mem, &end);
+	if (end == mem || val < 0.0)
+		goto err;
+	if (*end == '%')
+		metric |= SS_PCT;
+
+	td->ss_metric = metric;
+	td->ss_limit = val;
+	return 0;
+err:
+	log_err("fio: steadystate: iops:X, iops_slope:X, bw:X or bw_slope:X, X may be a percentage\n");
+	return 1;
+}
+
+static int str_layout_fill_cb(void *data, const char *mem)
+{
+	struct thread_data *td = data;
+
+	if (!strncmp(mem, "zero", 4)) {
+		td->layout_fill = LAYOUT_FILL_ZERO;
+		return 0;
+	} else if (!strncmp(mem, "none", 4)) {
+		td->layout_fill = LAYOUT_FILL_NONE;
+		return 0;
+	} else if (!strncmp(mem, "random", 6)) {
+		td->layout_fill = LAYOUT_FILL_RANDOM;
+		return 0;
+	}
+
+	log_err("fio: layout_fill types: zero, none, random\n");
+	return 1;
+}
+
+static int str_random_distribution_cb(void *data, const char *str)
+{
+	struct thread_data *td = data;
+
+	if (!dist_parse(str, &td->random_dist)) {
+		/*
+		 * plain random is the default, with the random map
+		 */
+		if (td->random_dist.type == FIO_DIST_UNIFORM)
+			td->random_dist.type = FIO_DIST_NONE;
+		return 0;
 	}
 
-	log_err("fio: verify types: md5, crc32\n");
+	log_err("fio: random_distribution= random, zipf:theta, pareto:h, hotcold:io%%/data%%\n");
+	return 1;
+}
+
+static int str_file_service_cb(void *data, const char *str)
+{
+	struct thread_data *td = data;
+
+	if (!strncmp(str, "roundrobin", 10)) {
+		td->file_dist.type = FIO_DIST_NONE;
+		return 0;
+	} else if (!strncmp(str, "weighted", 8)) {
+		td->file_dist.type = FIO_DIST_WEIGHTED;
+		return 0;
+	} else if (!dist_parse(str, &td->file_dist))
+		return 0;
+
+	log_err("fio: file_service_type= roundrobin, random, weighted, zipf:theta, pareto:h, hotcold:io%%/data%%\n");
+	return 1;
+}
+
+static int str_log_format_cb(void *data, const char *mem)
+{
+	struct thread_data *td = data;
+
+	if (!strncmp(mem, "text", 4)) {
+		td->log_format = LOG_FORMAT_TEXT;
+		return 0;
+	} else if (!strncmp(mem, "binary", 6)) {
+		td->log_format = LOG_FORMAT_BINARY;
+		return 0;
+	}
+
+	log_err("fio: log formats: text, binary\n");
 	return 1;
 }
 
@@ -905,7 +1430,7 @@ static int str_ioengine_cb(void *data, const char *str)
 	if (td->io_ops)
 		return 0;
 
-	log_err("fio: ioengine= libaio, posixaio, sync, mmap, sgio, splice, cpu, null\n");
+	log_err("fio: ioengine= libaio, posixaio, io_uring, sync, psync, pvsync, pvsync2, threadpool, mmap, sgio, splice, cpu, null\n");
 	log_err("fio: or specify path to dynamic ioengine module\n");
 	return 1;
 }
@@ -944,10 +1469,73 @@ static int str_cpumask_cb(void *data, unsigned int *val)
 {
 	struct thread_data *td = data;
 
-	fill_cpu_mask(td->cpumask, *val);
+	fill_cpu_mask(&td->cpumask, *val);
 	return 0;
 }
 
+#ifdef FIO_HAVE_NUMA
+static int str_numa_cpunodes_cb(void *data, const char *str)
+{
+	struct thread_data *td = data;
+
+	if (!strncmp(str, "auto", 4)) {
+		td->numa_cpunodes_auto = 1;
+		return 0;
+	}
+
+	td->numa_cpunodes_auto = 0;
+	if (fio_numa_parse_nodes(str, &td->numa_cpunodes)) {
+		log_err("fio: numa_cpu_nodes= auto, or a list of nodes\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int str_numa_mpol_cb(void *data, const char *str)
+{
+	struct thread_data *td = data;
+	const char *nodes = strchr(str, ':');
+
+	td->numa_memnodes = 0;
+
+	if (!strncmp(str, "default", 7)) {
+		td->numa_mem_mode = NUMA_MEM_DEFAULT;
+		return 0;
+	} else if (!strncmp(str, "local", 5)) {
+		td->numa_mem_mode = NUMA_MEM_LOCAL;
+		return 0;
+	} else if (!strncmp(str, "interleave", 10)) {
+		td->numa_mem_mode = NUMA_MEM_INTERLEAVE;
+		/*
+		 * no nodes given means all of them
+		 */
+		if (!nodes)
+			return 0;
+	} else if (!strncmp(str, "prefer", 6))
+		td->numa_mem_mode = NUMA_MEM_PREFER;
+	else if (!strncmp(str, "bind", 4))
+		td->numa_mem_mode = NUMA_MEM_BIND;
+	else
+		goto err;
+
+	if (!nodes || fio_numa_parse_nodes(nodes + 1, &td->numa_memnodes))
+		goto err;
+
+	/*
+	 * the kernel only takes a single preferred node
+	 */
+	if (td->numa_mem_mode == NUMA_MEM_PREFER &&
+	    (td->numa_memnodes & (td->numa_memnodes - 1)))
+		goto err;
+
+	return 0;
+err:
+	log_err("fio: numa_mem_policy= default, local, prefer:node, bind:nodes, interleave[:nodes]\n");
+	return 1;
+}
+#endif
+
 /*
  * This is our [ini] type file parser.
  */
@@ -1056,6 +1644,7 @@ static int fill_def_thread(void)
 	def_thread.max_bs[DDIR_READ] = def_thread.max_bs[DDIR_WRITE] = 0;
 	def_thread.odirect = DEF_ODIRECT;
 	def_thread.ratecycle = DEF_RATE_CYCLE;
+	def_thread.rate_spin = DEF_RATE_SPIN;
 	def_thread.sequential = DEF_SEQUENTIAL;
 	def_thread.timeout = def_timeout;
 	def_thread.overwrite = DEF_OVERWRITE;
@@ -1065,6 +1654,7 @@ static int fill_def_thread(void)
 	def_thread.bw_avg_time = DEF_BWAVGTIME;
 	def_thread.create_serialize = DEF_CREATE_SER;
 	def_thread.create_fsync = DEF_CREATE_FSYNC;
+	def_thread.fallocate = DEF_FALLOCATE;
 	def_thread.loops = DEF_LOOPS;
 	def_thread.verify = DEF_VERIFY;
 	def_thread.stonewall = DEF_STONEWALL;
@@ -1080,6 +1670,7 @@ static int fill_def_thread(void)
 	def_thread.write_lat_log = write_lat_log;
 	def_thread.norandommap = DEF_NO_RAND_MAP;
 	def_thread.hugepage_size = DEF_HUGEPAGE_SIZE;
+	def_thread.replay_time_scale = DEF_REPLAY_TIME_SCALE;
 #ifdef FIO_HAVE_DISK_UTIL
 	def_thread.do_disk_util = 1;
 #endif
@@ -1096,6 +1687,11 @@ static void usage(void)
 	printf("\t--bandwidth-log\tGenerate per-job bandwidth logs\n");
 	printf("\t--minimal\tMinimal (terse) output\n");
 	printf("\t--version\tPrint version info and exit\n");
+	printf("\t--status-interval Print group stats every x seconds\n");
+	printf("\t--log-to-text\tConvert a binary log to text and exit\n");
+	printf("\t--clocksource\tTime with gettimeofday, clock_gettime or cpu\n");
+	printf("\t--clock-test\tPrint clock source overheads and exit\n");
+	printf("\t--crctest\tPrint checksum speed of the verify types and exit\n");
 }
 
 static int parse_cmd_line(int argc, char *argv[])
@@ -1131,6 +1727,24 @@ static int parse_cmd_line(int argc, char *argv[])
 		case 'v':
 			printf("%s\n", fio_version_string);
 			exit(0);
+		case 'i':
+			status_interval = atoi(optarg);
+			break;
+		case 'L':
+			exit(log_to_text(optarg));
+		case 'c':
+			if (fio_set_clocksource(optarg))
+				exit(1);
+			break;
+		case 'T':
+			if (fio_clock_init())
+				exit(1);
+			fio_clock_test();
+			exit(0);
+		case 'C':
+			if (fio_clock_init())
+				exit(1);
+			exit(fio_crctest(optarg));
 		case FIO_GETOPT_JOB: {
 			const char *opt = long_options[lidx].name;
 			char *val = optarg;
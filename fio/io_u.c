@@ -3,26 +3,23 @@
 #include <string.h>
 #include <signal.h>
 #include <time.h>
-#include <assert.h>
 
 #include "fio.h"
 #include "os.h"
 
 /*
- * The ->file_map[] contains a map of blocks we have or have not done io
+ * The ->file_map contains a map of blocks we have or have not done io
  * to yet. Used to make sure we cover the entire range in a fair fashion.
  */
 static int random_map_free(struct thread_data *td, struct fio_file *f,
 			   unsigned long long block)
 {
-	unsigned int idx = RAND_MAP_IDX(td, f, block);
-	unsigned int bit = RAND_MAP_BIT(td, f, block);
-
-	return (f->file_map[idx] & (1UL << bit)) == 0;
+	return !axmap_isset(f->file_map, TO_MAP_BLOCK(td, f, block));
 }
 
 /*
- * Mark a given offset as used in the map.
+ * Mark a given offset as used in the map. If part of the range was already
+ * done, trim the io to the free part.
  */
 static void mark_random_map(struct thread_data *td, struct fio_file *f,
 			    struct io_u *io_u)
@@ -32,83 +29,110 @@ static void mark_random_map(struct thread_data *td, struct fio_file *f,
 	unsigned int blocks;
 
 	block = io_u->offset / (unsigned long long) min_bs;
-	blocks = 0;
-	while (blocks < (io_u->buflen / min_bs)) {
-		unsigned int idx, bit;
+	blocks = axmap_set_nr(f->file_map, TO_MAP_BLOCK(td, f, block),
+				io_u->buflen / min_bs);
+
+	if ((blocks * min_bs) < io_u->buflen)
+		io_u->buflen = blocks * min_bs;
+}
 
-		if (!random_map_free(td, f, block))
-			break;
+/*
+ * Return the next free block in the map.
+ */
+static int get_next_free_block(struct fio_file *f, unsigned long long *b)
+{
+	*b = axmap_first_free(f->file_map);
+	if (*b == -1ULL)
+		return 1;
 
-		idx = RAND_MAP_IDX(td, f, block);
-		bit = RAND_MAP_BIT(td, f, block);
+	return 0;
+}
 
-		assert(idx < f->num_maps);
+/*
+ * Generate a random new block and see if it's used. Repeat until we find a
+ * free one, or fall back to scanning the map after a while.
+ */
+static int get_next_rand_block(struct thread_data *td, struct fio_file *f,
+			       int ddir, unsigned long long *b)
+{
+	unsigned long long max_blocks = f->file_size / td->min_bs[ddir];
+	unsigned long long rb;
+	int loops = 50;
+	long r;
 
-		f->file_map[idx] |= (1UL << bit);
-		block++;
-		blocks++;
-	}
+	do {
+		r = os_random_long(&td->random_state);
+		*b = ((max_blocks - 1) * r / (unsigned long long) (RAND_MAX+1.0));
+		if (td->norandommap)
+			return 0;
+		rb = *b + (f->file_offset / td->min_bs[ddir]);
+		loops--;
+	} while (!random_map_free(td, f, rb) && loops);
 
-	if ((blocks * min_bs) < io_u->buflen)
-		io_u->buflen = blocks * min_bs;
+	if (!loops)
+		return get_next_free_block(f, b);
+
+	return 0;
 }
 
 /*
- * Return the next free block in the map.
+ * Let the lfsr hand out the next block. Every block comes up exactly once,
+ * so we only need to check the map if larger ios may have covered it.
  */
-static int get_next_free_block(struct thread_data *td, struct fio_file *f,
+static int get_next_lfsr_block(struct thread_data *td, struct fio_file *f,
 			       unsigned long long *b)
 {
-	int i;
+	do {
+		if (lfsr_next(&f->lfsr, b))
+			return 1;
+	} while (f->file_map &&
+		 !random_map_free(td, f, *b + f->file_offset / td->rw_min_bs));
 
-	*b = 0;
-	i = 0;
-	while ((*b) * td->rw_min_bs < f->real_file_size) {
-		if (f->file_map[i] != -1UL) {
-			*b += ffz(f->file_map[i]);
-			return 0;
-		}
+	return 0;
+}
 
-		*b += BLOCKS_PER_MAP;
-		i++;
-	}
+/*
+ * Pick a part of the file from the skewed distribution, then a block in
+ * that part
+ */
+static unsigned long long get_next_dist_block(struct thread_data *td,
+					      struct fio_file *f, int ddir)
+{
+	unsigned long long max_blocks = f->file_size / td->min_bs[ddir];
+	unsigned long long nr = td->offset_alias.nr, part, start, end;
+
+	part = dist_alias_next(&td->offset_alias, &td->dist_state);
+	start = part * max_blocks / nr;
+	end = (part + 1) * max_blocks / nr;
+	if (end <= start)
+		return start;
 
-	return 1;
+	return start + (frand_next(&td->dist_state) >> 11) % (end - start);
 }
 
 /*
- * For random io, generate a random new block and see if it's used. Repeat
- * until we find a free one. For sequential io, just return the end of
- * the last io issued.
+ * For random io, get a new random block. For sequential io, just return
+ * the end of the last io issued.
  */
 static int get_next_offset(struct thread_data *td, struct fio_file *f,
 			   unsigned long long *offset, int ddir)
 {
-	unsigned long long b, rb;
-	long r;
-
-	if (!td->sequential) {
-		unsigned long long max_blocks = f->file_size / td->min_bs[ddir];
-		int loops = 50;
-
-		do {
-			r = os_random_long(&td->random_state);
-			b = ((max_blocks - 1) * r / (unsigned long long) (RAND_MAX+1.0));
-			if (td->norandommap)
-				break;
-			rb = b + (f->file_offset / td->min_bs[ddir]);
-			loops--;
-		} while (!random_map_free(td, f, rb) && loops);
-
-		if (!loops) {
-			if (get_next_free_block(td, f, &b))
-				return 1;
-		}
-	} else
-		b = f->last_pos / td->min_bs[ddir];
+	unsigned int bs = td->min_bs[ddir];
+	unsigned long long b;
+
+	if (td->sequential)
+		b = f->last_pos / bs;
+	else if (td->random_dist.type != FIO_DIST_NONE)
+		b = get_next_dist_block(td, f, ddir);
+	else if (td->random_generator == FIO_RAND_GEN_LFSR && !td->norandommap) {
+		bs = td->rw_min_bs;
+		if (get_next_lfsr_block(td, f, &b))
+			return 1;
+	} else if (get_next_rand_block(td, f, ddir, &b))
+		return 1;
 
-	*offset = (b * td->min_bs[ddir]) + f->file_offset;
-	if (*offset > f->real_file_size)
+	*offset = (b * bs) + f->file_offset;
+	if (*offset >= f->real_file_size)
 		return 1;
 
 	return 0;
@@ -149,8 +173,14 @@ static unsigned int get_next_buflen(struct thread_data *td, int ddir)
  */
 static enum fio_ddir get_rw_ddir(struct thread_data *td)
 {
+	/*
+	 * with open loop rate control, the schedule decides
+	 */
+	if (td->rate_open)
+		return td->rate_ddir;
+
 	if (td_rw(td)) {
-		struct timeval now;
+		struct timespec now;
 		unsigned long elapsed;
 
 		fio_gettime(&now, NULL);
@@ -178,14 +208,68 @@ static enum fio_ddir get_rw_ddir(struct thread_data *td)
 		return DDIR_WRITE;
 }
 
+/*
+ * Fill a write buffer with random data. A dedupe_percentage of buffers
+ * repeat the last unique one, and buffer_compress_percentage of every
+ * buffer_compress_chunk is zeroed so compression shrinks it by about
+ * that much.
+ */
+void fill_io_buffer(struct thread_data *td, void *buf, unsigned int len)
+{
+	struct frand_state *fs = &td->buf_state;
+	struct frand_state dup;
+	unsigned int this_len, rand_len;
+	unsigned char *p = buf;
+
+	if (td->dedupe_percentage) {
+		if (frand_next(&td->dedupe_state) % 100 < td->dedupe_percentage) {
+			memcpy(&dup, &td->buf_state_prev, sizeof(dup));
+			fs = &dup;
+		} else
+			memcpy(&td->buf_state_prev, &td->buf_state, sizeof(td->buf_state));
+	}
+
+	if (!td->compress_percentage) {
+		fill_random_buf(fs, buf, len);
+		return;
+	}
+
+	while (len) {
+		this_len = min(len, td->compress_chunk);
+		rand_len = this_len * (100 - td->compress_percentage) / 100;
+
+		fill_random_buf(fs, p, rand_len);
+		memset(p + rand_len, 0, this_len - rand_len);
+
+		p += this_len;
+		len -= this_len;
+	}
+}
+
 void put_io_u(struct thread_data *td, struct io_u *io_u)
 {
 	io_u->file = NULL;
-	list_del(&io_u->list);
-	list_add(&io_u->list, &td->io_u_freelist);
+	io_u_clear_busy(td, io_u);
+	td->io_u_free[td->io_u_nr_free++] = io_u_index(td, io_u);
 	td->cur_depth--;
 }
 
+/*
+ * Start over on a file, every block can be done again
+ */
+void reset_file_io_state(struct thread_data *td, struct fio_file *f)
+{
+	f->last_pos = 0;
+
+	if (f->file_map)
+		axmap_reset(f->file_map);
+
+	if (!td->sequential && !td->norandommap &&
+	    td->random_generator == FIO_RAND_GEN_LFSR)
+		lfsr_init(&f->lfsr, f->file_size / td->rw_min_bs,
+				os_random_long(&td->random_state));
+}
+
 static int fill_io_u(struct thread_data *td, struct fio_file *f,
 		     struct io_u *io_u)
 {
@@ -193,7 +277,7 @@ static int fill_io_u(struct thread_data *td, struct fio_file *f,
 	 * If using an iolog, grab next piece if any available.
 	 */
 	if (td->read_iolog)
-		return read_iolog_get(td, io_u);
+		return read_iolog_get(td, f, io_u);
 
 	/*
 	 * see if it's time to sync
@@ -209,22 +293,24 @@ static int fill_io_u(struct thread_data *td, struct fio_file *f,
 
 	/*
 	 * No log, let the seq/rand engine retrieve the next position.
+	 * With skewed file selection the popular files are done first,
+	 * they are started over until the job has done its io_size.
 	 */
-	if (!get_next_offset(td, f, &io_u->offset, io_u->ddir)) {
-		io_u->buflen = get_next_buflen(td, io_u->ddir);
-		if (io_u->buflen) {
-			/*
-			 * If using a write iolog, store this entry.
-			 */
-			if (td->write_iolog_file)
-				write_iolog_put(td, io_u);
-
-			io_u->file = f;
-			return 0;
-		}
+	if (get_next_offset(td, f, &io_u->offset, io_u->ddir)) {
+		if (td->file_dist.type == FIO_DIST_NONE)
+			return 1;
+
+		reset_file_io_state(td, f);
+		if (get_next_offset(td, f, &io_u->offset, io_u->ddir))
+			return 1;
 	}
 
-	return 1;
+	io_u->buflen = get_next_buflen(td, io_u->ddir);
+	if (!io_u->buflen)
+		return 1;
+
+	io_u->file = f;
+	return 0;
 }
 
 struct io_u *__get_io_u(struct thread_data *td)
@@ -232,13 +318,12 @@ struct io_u *__get_io_u(struct thread_data *td)
 	struct io_u *io_u = NULL;
 
 	if (!queue_full(td)) {
-		io_u = list_entry(td->io_u_freelist.next, struct io_u, list);
+		io_u = &td->io_us[td->io_u_free[--td->io_u_nr_free]];
 
 		io_u->buflen = 0;
 		io_u->error = 0;
 		io_u->resid = 0;
-		list_del(&io_u->list);
-		list_add(&io_u->list, &td->io_u_busylist);
+		io_u_set_busy(td, io_u);
 		td->cur_depth++;
 	}
 
@@ -267,6 +352,11 @@ struct io_u *get_io_u(struct thread_data *td, struct fio_file *f)
 		return NULL;
 	}
 
+	/*
+	 * a replayed iolog picks the file itself
+	 */
+	f = io_u->file;
+
 	if (io_u->buflen + io_u->offset > f->real_file_size) {
 		if (td->io_ops->flags & FIO_RAWIO) {
 			put_io_u(td, io_u);
@@ -282,13 +372,15 @@ struct io_u *get_io_u(struct thread_data *td, struct fio_file *f)
 			return NULL;
 		}
 
-		if (!td->read_iolog && !td->sequential && !td->norandommap)
+		if (!td->read_iolog && !td->sequential && f->file_map)
 			mark_random_map(td, f, io_u);
 
 		f->last_pos += io_u->buflen;
 
 		if (td->verify != VERIFY_NONE)
 			populate_verify_io_u(td, io_u);
+		else if (td->refill_buffers && io_u->ddir == DDIR_WRITE)
+			fill_io_buffer(td, io_u->buf, io_u->buflen);
 	}
 
 	if (td_io_prep(td, io_u)) {
@@ -297,13 +389,20 @@ struct io_u *get_io_u(struct thread_data *td, struct fio_file *f)
 	}
 
 	fio_gettime(&io_u->start_time, NULL);
+
+	/*
+	 * If using a write iolog, store this entry.
+	 */
+	if (td->write_iolog_file)
+		write_iolog_put(td, io_u);
+
 	return io_u;
 }
 
 void io_completed(struct thread_data *td, struct io_u *io_u,
 		  struct io_completion_data *icd)
 {
-	unsigned long msec;
+	unsigned long long nsec;
 
 	if (io_u->ddir == DDIR_SYNC) {
 		td->last_was_sync = 1;
@@ -323,9 +422,15 @@ void io_completed(struct thread_data *td, struct io_u *io_u,
 
 		io_u->file->last_completed_pos = io_u->offset + io_u->buflen;
 
-		msec = mtime_since(&io_u->issue_time, &icd->time);
+		/*
+		 * open loop ios are timed from when they were due
+		 */
+		if (td->rate_open)
+			nsec = ntime_since(&io_u->start_time, &icd->time);
+		else
+			nsec = ntime_since(&io_u->issue_time, &icd->time);
 
-		add_clat_sample(td, idx, msec);
+		add_clat_sample(td, idx, nsec);
 		add_bw_sample(td, idx, &icd->time);
 
 		if ((td_rw(td) || td_write(td)) && idx == DDIR_WRITE)
@@ -352,6 +457,9 @@ void ios_completed(struct thread_data *td, struct io_completion_data *icd)
 		io_completed(td, io_u, icd);
 		put_io_u(td, io_u);
 	}
+
+	if (status_interval)
+		update_io_snapshot(td, &icd->time);
 }
 
 
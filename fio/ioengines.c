@@ -176,9 +176,36 @@ int td_io_getevents(struct thread_data *td, int min, int max,
 
 int td_io_queue(struct thread_data *td, struct io_u *io_u)
 {
+	int ret;
+
 	fio_gettime(&io_u->issue_time, NULL);
 
-	return td->io_ops->queue(td, io_u);
+	if (!td->first_io_done) {
+		td->first_io_msec = mtime_since_genesis();
+		td->first_io_done = 1;
+	}
+
+	ret = td->io_ops->queue(td, io_u);
+	if (!ret)
+		td->io_u_queued++;
+
+	return ret;
+}
+
+/*
+ * Engines with a ->commit() hook may hold on to queued io_u's, so they
+ * can be submitted to the OS in one go. Kick off anything pending.
+ */
+int td_io_commit(struct thread_data *td)
+{
+	if (!td->io_u_queued)
+		return 0;
+
+	td->io_u_queued = 0;
+	if (td->io_ops->commit)
+		return td->io_ops->commit(td);
+
+	return 0;
 }
 
 int td_io_init(struct thread_data *td)
@@ -0,0 +1,141 @@
+/*
+ * Galois LFSR, generating a random permutation of [0, nr_vals).
+ *
+ * The register width is the smallest that covers nr_vals. A maximal length
+ * register of n bits cycles through all 2^n - 1 non-zero states, so
+ * subtracting one gives every value in [0, 2^n - 1) exactly once. Values
+ * beyond nr_vals are simply skipped, which costs less than one extra step
+ * per value on average. No memory is needed to track what has been used.
+ */
+#include "lfsr.h"
+
+#define LFSR_MIN_BITS	2
+#define LFSR_MAX_BITS	64
+
+/*
+ * Taps for maximal length registers, from Xilinx XAPP052.
+ */
+static const unsigned char taps[LFSR_MAX_BITS + 1][6] = {
+	[2]  = { 2, 1 },
+	[3]  = { 3, 2 },
+	[4]  = { 4, 3 },
+	[5]  = { 5, 3 },
+	[6]  = { 6, 5 },
+	[7]  = { 7, 6 },
+	[8]  = { 8, 6, 5, 4 },
+	[9]  = { 9, 5 },
+	[10] = { 10, 7 },
+	[11] = { 11, 9 },
+	[12] = { 12, 6, 4, 1 },
+	[13] = { 13, 4, 3, 1 },
+	[14] = { 14, 5, 3, 1 },
+	[15] = { 15, 14 },
+	[16] = { 16, 15, 13, 4 },
+	[17] = { 17, 14 },
+	[18] = { 18, 11 },
+	[19] = { 19, 6, 2, 1 },
+	[20] = { 20, 17 },
+	[21] = { 21, 19 },
+	[22] = { 22, 21 },
+	[23] = { 23, 18 },
+	[24] = { 24, 23, 22, 17 },
+	[25] = { 25, 22 },
+	[26] = { 26, 6, 2, 1 },
+	[27] = { 27, 5, 2, 1 },
+	[28] = { 28, 25 },
+	[29] = { 29, 27 },
+	[30] = { 30, 6, 4, 1 },
+	[31] = { 31, 28 },
+	[32] = { 32, 22, 2, 1 },
+	[33] = { 33, 20 },
+	[34] = { 34, 27, 2, 1 },
+	[35] = { 35, 33 },
+	[36] = { 36, 25 },
+	[37] = { 37, 5, 4, 3, 2, 1 },
+	[38] = { 38, 6, 5, 1 },
+	[39] = { 39, 35 },
+	[40] = { 40, 38, 21, 19 },
+	[41] = { 41, 38 },
+	[42] = { 42, 41, 20, 19 },
+	[43] = { 43, 42, 38, 37 },
+	[44] = { 44, 43, 18, 17 },
+	[45] = { 45, 44, 42, 41 },
+	[46] = { 46, 45, 26, 25 },
+	[47] = { 47, 42 },
+	[48] = { 48, 47, 21, 20 },
+	[49] = { 49, 40 },
+	[50] = { 50, 49, 24, 23 },
+	[51] = { 51, 50, 36, 35 },
+	[52] = { 52, 49 },
+	[53] = { 53, 52, 38, 37 },
+	[54] = { 54, 53, 18, 17 },
+	[55] = { 55, 31 },
+	[56] = { 56, 55, 35, 34 },
+	[57] = { 57, 50 },
+	[58] = { 58, 39 },
+	[59] = { 59, 58, 38, 37 },
+	[60] = { 60, 59 },
+	[61] = { 61, 60, 46, 45 },
+	[62] = { 62, 61, 6, 5 },
+	[63] = { 63, 62 },
+	[64] = { 64, 63, 61, 60 },
+};
+
+static inline void lfsr_step(struct fio_lfsr *fl)
+{
+	unsigned long long lsb = fl->state & 1;
+
+	fl->state >>= 1;
+	if (lsb)
+		fl->state ^= fl->mask;
+}
+
+/*
+ * Return the next value of the permutation in 'val'. Returns 1 once all
+ * values have been handed out.
+ */
+int lfsr_next(struct fio_lfsr *fl, unsigned long long *val)
+{
+	if (fl->cur_val == fl->num_vals)
+		return 1;
+
+	do {
+		lfsr_step(fl);
+	} while (fl->state - 1 >= fl->num_vals);
+
+	*val = fl->state - 1;
+	fl->cur_val++;
+	return 0;
+}
+
+/*
+ * Setup the register to cover nr_vals values. The seed selects the
+ * starting point in the cycle, and thus the permutation.
+ */
+int lfsr_init(struct fio_lfsr *fl, unsigned long long nr_vals,
+	      unsigned long seed)
+{
+	unsigned int bits, i;
+
+	fl->num_vals = fl->cur_val = 0;
+	if (!nr_vals)
+		return 1;
+
+	bits = LFSR_MIN_BITS;
+	while (bits < LFSR_MAX_BITS && ((1ULL << bits) - 1) < nr_vals)
+		bits++;
+
+	fl->mask = 0;
+	for (i = 0; i < sizeof(taps[0]) && taps[bits][i]; i++)
+		fl->mask |= 1ULL << (taps[bits][i] - 1);
+
+	if (bits == LFSR_MAX_BITS)
+		fl->max_val = -1ULL;
+	else
+		fl->max_val = (1ULL << bits) - 1;
+
+	fl->num_vals = nr_vals;
+	fl->cur_val = 0;
+	fl->state = (seed % fl->max_val) + 1;
+	return 0;
+}
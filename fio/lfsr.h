@@ -0,0 +1,19 @@
+#ifndef FIO_LFSR_H
+#define FIO_LFSR_H
+
+/*
+ * Maximal length linear feedback shift register. Used to walk a range of
+ * values in a random order, hitting each value exactly once per cycle.
+ */
+struct fio_lfsr {
+	unsigned long long state;
+	unsigned long long mask;
+	unsigned long long max_val;
+	unsigned long long num_vals;
+	unsigned long long cur_val;
+};
+
+extern int lfsr_init(struct fio_lfsr *, unsigned long long, unsigned long);
+extern int lfsr_next(struct fio_lfsr *, unsigned long long *);
+
+#endif
@@ -1,29 +1,238 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
 #include "list.h"
 #include "fio.h"
 
+#define IOLOG_BUF_SIZE	(256 * 1024)
+
+static const char iolog_ver2[] = "fio version 2 iolog";
+
+static const char *iolog_act[] = {
+	[DDIR_READ]	= "read",
+	[DDIR_WRITE]	= "write",
+	[DDIR_SYNC]	= "sync",
+};
+
+/*
+ * Each entry is stamped with its issue time in usecs since the job started,
+ * so a replay can reproduce the original inter-arrival times.
+ */
 void write_iolog_put(struct thread_data *td, struct io_u *io_u)
 {
-	fprintf(td->iolog_f, "%u,%llu,%u\n", io_u->ddir, io_u->offset, io_u->buflen);
+	fprintf(td->iolog_f, "%lu %s %s", utime_since(&td->epoch, &io_u->start_time), io_u->file->file_name, iolog_act[io_u->ddir]);
+
+	if (io_u->ddir != DDIR_SYNC)
+		fprintf(td->iolog_f, " %llu %u", io_u->offset, io_u->buflen);
+
+	fputc('\n', td->iolog_f);
 }
 
-int read_iolog_get(struct thread_data *td, struct io_u *io_u)
+/*
+ * Files in the log that match a job file by name use that, others are
+ * handed out over the job files in the order they were added.
+ */
+static void iolog_file_add(struct thread_data *td, const char *name)
 {
-	struct io_piece *ipo;
+	struct iolog_file *lf;
+	struct fio_file *f;
+	int i;
 
-	if (!list_empty(&td->io_log_list)) {
-		ipo = list_entry(td->io_log_list.next, struct io_piece, list);
-		list_del(&ipo->list);
-		io_u->offset = ipo->offset;
-		io_u->buflen = ipo->len;
-		io_u->ddir = ipo->ddir;
-		io_u->file = ipo->file;
-		free(ipo);
+	for_each_file(td, f, i)
+		if (!strcmp(f->file_name, name))
+			break;
+
+	if (i == (int) td->nr_files)
+		f = &td->files[td->iolog_nr_files % td->nr_files];
+
+	td->iolog_files = realloc(td->iolog_files, (td->iolog_nr_files + 1) * sizeof(struct iolog_file));
+	lf = &td->iolog_files[td->iolog_nr_files++];
+	lf->file_name = strdup(name);
+	lf->file = f;
+}
+
+static struct fio_file *iolog_file_lookup(struct thread_data *td,
+					  const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < td->iolog_nr_files; i++)
+		if (!strcmp(td->iolog_files[i].file_name, name))
+			return td->iolog_files[i].file;
+
+	return NULL;
+}
+
+static int iolog_parse_v1(struct thread_data *td, char *p)
+{
+	struct io_piece *ipo = &td->iolog_next;
+	unsigned long long offset;
+	unsigned int bytes;
+	int rw;
+
+	if (sscanf(p, "%d,%llu,%u", &rw, &offset, &bytes) != 3) {
+		log_err("bad iolog: %s\n", p);
+		return 1;
+	}
+	if (rw != DDIR_READ && rw != DDIR_WRITE) {
+		log_err("bad ddir: %d\n", rw);
+		return 1;
+	}
+
+	ipo->file = NULL;
+	ipo->offset = offset;
+	ipo->len = bytes;
+	ipo->ddir = (enum fio_ddir) rw;
+	ipo->delay = 0;
+	return 0;
+}
+
+static int iolog_parse_v2(struct thread_data *td, char *p)
+{
+	struct io_piece *ipo = &td->iolog_next;
+	unsigned long long stamp, offset;
+	char fname[256], act[16];
+	struct fio_file *f;
+	unsigned int bytes;
+	int r;
+
+	r = sscanf(p, "%llu %255s %15s %llu %u", &stamp, fname, act, &offset, &bytes);
+	if (r == 3 && !strcmp(act, "add")) {
+		iolog_file_add(td, fname);
+		return 1;
+	} else if (r == 3 && !strcmp(act, "sync")) {
+		ipo->ddir = DDIR_SYNC;
+		offset = 0;
+		bytes = 0;
+	} else if (r == 5 && !strcmp(act, "read"))
+		ipo->ddir = DDIR_READ;
+	else if (r == 5 && !strcmp(act, "write"))
+		ipo->ddir = DDIR_WRITE;
+	else {
+		log_err("bad iolog: %s\n", p);
+		return 1;
+	}
+
+	f = iolog_file_lookup(td, fname);
+	if (!f) {
+		log_err("iolog: file %s not added\n", fname);
+		return 1;
+	}
+
+	/*
+	 * replay time starts with the first io, not at the trace origin
+	 */
+	if (!td->iolog_started) {
+		td->iolog_started = 1;
+		td->iolog_first = stamp;
+		fio_gettime(&td->iolog_start, NULL);
+	}
+
+	ipo->file = f;
+	ipo->offset = offset;
+	ipo->len = bytes;
+	ipo->delay = 0;
+	if (stamp > td->iolog_first)
+		ipo->delay = (stamp - td->iolog_first) * td->replay_time_scale / 100;
+
+	return 0;
+}
+
+/*
+ * The files are opened for the directions of the job, so the log can't
+ * do io the job wasn't set up for.
+ */
+static int iolog_ddir_allowed(struct thread_data *td, enum fio_ddir ddir)
+{
+	if (ddir == DDIR_SYNC || td_rw(td))
+		return 1;
+	if (ddir == DDIR_WRITE)
+		return td_write(td);
+
+	return td_read(td);
+}
+
+/*
+ * Make sure the next io entry is loaded, reading the log a line at a time.
+ * Returns 1 when the log is exhausted, or has io the job can't replay.
+ */
+static int iolog_next(struct thread_data *td)
+{
+	char line[512];
+	int ret;
+
+	while (!td->iolog_next_valid) {
+		if (!fgets(line, sizeof(line), td->iolog_f))
+			return 1;
+
+		if (td->iolog_version == 2)
+			ret = iolog_parse_v2(td, line);
+		else
+			ret = iolog_parse_v1(td, line);
+
+		if (ret)
+			continue;
+
+		if (!iolog_ddir_allowed(td, td->iolog_next.ddir)) {
+			log_err("fio: %s: iolog %s has %ss, which rw doesn't allow\n",
+				td->name, td->read_iolog_file,
+				td->iolog_next.ddir == DDIR_WRITE ? "write" : "read");
+			td_verror(td, EINVAL);
+			fseek(td->iolog_f, 0, SEEK_END);
+			return 1;
+		}
+
+		td->iolog_next_valid = 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns how many usecs remain before the next logged io is due.
+ */
+unsigned long iolog_delay(struct thread_data *td)
+{
+	unsigned long elapsed;
+
+	if (td->replay_no_stall || iolog_next(td))
+		return 0;
+
+	elapsed = utime_since_now(&td->iolog_start);
+	if (elapsed >= td->iolog_next.delay)
+		return 0;
+
+	return td->iolog_next.delay - elapsed;
+}
+
+int read_iolog_get(struct thread_data *td, struct fio_file *f,
+		   struct io_u *io_u)
+{
+	struct io_piece *ipo = &td->iolog_next;
+	unsigned int max_bs;
+
+	if (iolog_next(td))
+		return 1;
+
+	io_u->ddir = ipo->ddir;
+	io_u->offset = ipo->offset;
+	io_u->file = ipo->file ? ipo->file : f;
+
+	/*
+	 * entries larger than the io buffers are issued in pieces
+	 */
+	max_bs = max(td->max_bs[DDIR_READ], td->max_bs[DDIR_WRITE]);
+	if (ipo->len > max_bs) {
+		io_u->buflen = max_bs;
+		ipo->offset += max_bs;
+		ipo->len -= max_bs;
 		return 0;
 	}
 
-	return 1;
+	io_u->buflen = ipo->len;
+	td->iolog_next_valid = 0;
+	return 0;
 }
 
 void prune_io_piece_log(struct thread_data *td)
@@ -82,16 +291,29 @@ void write_iolog_close(struct thread_data *td)
 	free(td->iolog_buf);
 }
 
+void read_iolog_close(struct thread_data *td)
+{
+	unsigned int i;
+
+	for (i = 0; i < td->iolog_nr_files; i++)
+		free(td->iolog_files[i].file_name);
+
+	free(td->iolog_files);
+	td->iolog_files = NULL;
+	td->iolog_nr_files = 0;
+
+	fclose(td->iolog_f);
+	free(td->iolog_buf);
+}
+
 /*
- * Open a stored log and read in the entries.
+ * Open a stored log for replay. Entries are parsed as the job asks for
+ * them, so only a read-ahead buffer of the log is ever held in memory.
  */
 static int init_iolog_read(struct thread_data *td)
 {
-	unsigned long long offset;
-	unsigned int bytes;
-	char *str, *p;
+	char line[64];
 	FILE *f;
-	int rw, reads, writes;
 
 	f = fopen(td->read_iolog_file, "r");
 	if (!f) {
@@ -99,50 +321,24 @@ static int init_iolog_read(struct thread_data *td)
 		return 1;
 	}
 
+	td->iolog_buf = malloc(IOLOG_BUF_SIZE);
+	setvbuf(f, td->iolog_buf, _IOFBF, IOLOG_BUF_SIZE);
+	fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+
 	/*
-	 * Read in the read iolog and store it, reuse the infrastructure
-	 * for doing verifications.
+	 * logs without a version header are the old rw,offset,length format
 	 */
-	str = malloc(4096);
-	reads = writes = 0;
-	while ((p = fgets(str, 4096, f)) != NULL) {
-		struct io_piece *ipo;
-
-		if (sscanf(p, "%d,%llu,%u", &rw, &offset, &bytes) != 3) {
-			log_err("bad iolog: %s\n", p);
-			continue;
-		}
-		if (rw == DDIR_READ)
-			reads++;
-		else if (rw == DDIR_WRITE)
-			writes++;
-		else {
-			log_err("bad ddir: %d\n", rw);
-			continue;
-		}
-
-		ipo = malloc(sizeof(*ipo));
-		INIT_LIST_HEAD(&ipo->list);
-		ipo->offset = offset;
-		ipo->len = bytes;
-		ipo->ddir = (enum fio_ddir) rw;
-		if (bytes > td->max_bs[rw])
-			td->max_bs[rw] = bytes;
-		list_add_tail(&ipo->list, &td->io_log_list);
-	}
-
-	free(str);
-	fclose(f);
-
-	if (!reads && !writes)
-		return 1;
-	else if (reads && !writes)
-		td->ddir = DDIR_READ;
-	else if (!reads && writes)
-		td->ddir = DDIR_READ;
+	td->iolog_version = 1;
+	if (fgets(line, sizeof(line), f) &&
+	    !strncmp(line, iolog_ver2, strlen(iolog_ver2)))
+		td->iolog_version = 2;
 	else
-		td->iomix = 1;
+		rewind(f);
 
+	td->iolog_f = f;
+	td->iolog_next_valid = 0;
+	td->iolog_started = 0;
+	td->read_iolog = 1;
 	return 0;
 }
 
@@ -151,10 +347,12 @@ static int init_iolog_read(struct thread_data *td)
  */
 static int init_iolog_write(struct thread_data *td)
 {
-	FILE *f;
+	struct fio_file *f;
+	FILE *fp;
+	int i;
 
-	f = fopen(td->write_iolog_file, "w+");
-	if (!f) {
+	fp = fopen(td->write_iolog_file, "w+");
+	if (!fp) {
 		perror("fopen write iolog");
 		return 1;
 	}
@@ -162,9 +360,14 @@ static int init_iolog_write(struct thread_data *td)
 	/*
 	 * That's it for writing, setup a log buffer and we're done.
 	  */
-	td->iolog_f = f;
+	td->iolog_f = fp;
 	td->iolog_buf = malloc(8192);
-	setvbuf(f, td->iolog_buf, _IOFBF, 8192);
+	setvbuf(fp, td->iolog_buf, _IOFBF, 8192);
+
+	fprintf(fp, "%s\n", iolog_ver2);
+	for_each_file(td, f, i)
+		fprintf(fp, "0 %s add\n", f->file_name);
+
 	return 0;
 }
 
@@ -185,7 +388,22 @@ int init_iolog(struct thread_data *td)
 
 int setup_rate(struct thread_data *td)
 {
-	int nr_reads_per_sec;
+	unsigned long nr_ios_per_sec;
+	int ddir;
+
+	for (ddir = DDIR_READ; ddir <= DDIR_WRITE; ddir++) {
+		if (td->rate_iops[ddir] && td->rate_bw[ddir]) {
+			log_err("fio: rate_iops and rate_bw given for the same direction\n");
+			return -1;
+		}
+		if (td->rate_iops[ddir] || td->rate_bw[ddir])
+			td->rate_open = 1;
+	}
+
+	if (td->rate_open && td->rate) {
+		log_err("fio: rate can't be combined with rate_iops or rate_bw\n");
+		return -1;
+	}
 
 	if (!td->rate)
 		return 0;
@@ -195,39 +413,282 @@ int setup_rate(struct thread_data *td)
 		return -1;
 	}
 
-	nr_reads_per_sec = (td->rate * 1024) / td->min_bs[DDIR_READ];
-	td->rate_usec_cycle = 1000000 / nr_reads_per_sec;
+	for (ddir = DDIR_READ; ddir <= DDIR_WRITE; ddir++) {
+		nr_ios_per_sec = (td->rate * 1024) / td->min_bs[ddir];
+		if (!nr_ios_per_sec)
+			nr_ios_per_sec = 1;
+		td->rate_usec_cycle[ddir] = 1000000 / nr_ios_per_sec;
+	}
+
 	td->rate_pending_usleep = 0;
 	return 0;
 }
 
-void setup_log(struct io_log **log)
+/*
+ * Binary logs start with this, followed by one record per sample: the
+ * time delta to the previous sample in msecs and the value, both as
+ * unsigned LEB128 varints, and then the data direction as a byte.
+ */
+#define LOG_BINARY_MAGIC	"fiolog1\n"
+#define LOG_BINARY_MAGIC_LEN	8
+
+static void put_varint(FILE *f, unsigned long long val)
+{
+	while (val >= 0x80) {
+		putc((val & 0x7f) | 0x80, f);
+		val >>= 7;
+	}
+	putc(val, f);
+}
+
+static int get_varint(FILE *f, unsigned long long *val)
+{
+	unsigned int shift = 0;
+	int c;
+
+	*val = 0;
+	do {
+		c = getc(f);
+		if (c == EOF || shift > 63)
+			return 1;
+
+		*val |= (unsigned long long) (c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return 0;
+}
+
+static void write_log_chunk(struct io_log *log, struct io_log_chunk *c)
+{
+	struct io_sample *s;
+	unsigned long i;
+
+	for (i = 0; i < c->nr_samples; i++) {
+		s = &c->samples[i];
+
+		if (log->format == LOG_FORMAT_TEXT) {
+			fprintf(log->f, "%lu, %llu, %u\n", s->time, s->val, s->ddir);
+			continue;
+		}
+
+		/*
+		 * times only go backwards if the clock source does, just
+		 * clamp those
+		 */
+		if (s->time < log->last_time)
+			s->time = log->last_time;
+
+		put_varint(log->f, s->time - log->last_time);
+		put_varint(log->f, s->val);
+		putc(s->ddir, log->f);
+		log->last_time = s->time;
+	}
+}
+
+static void *log_writer_thread(void *data)
+{
+	struct io_log *log = data;
+	struct io_log_chunk *c;
+
+	pthread_mutex_lock(&log->lock);
+	for (;;) {
+		while (list_empty(&log->full_list) && !log->exit)
+			pthread_cond_wait(&log->cond, &log->lock);
+
+		if (list_empty(&log->full_list))
+			break;
+
+		c = list_entry(log->full_list.next, struct io_log_chunk, list);
+		list_del(&c->list);
+		pthread_mutex_unlock(&log->lock);
+
+		write_log_chunk(log, c);
+
+		pthread_mutex_lock(&log->lock);
+		list_add(&c->list, &log->free_list);
+		pthread_cond_broadcast(&log->cond);
+	}
+	pthread_mutex_unlock(&log->lock);
+
+	return NULL;
+}
+
+/*
+ * Get an empty chunk. Allocate one if we are below the limit, otherwise
+ * wait for the writer to return one. Called with the lock held.
+ */
+static struct io_log_chunk *get_log_chunk(struct io_log *log)
+{
+	struct io_log_chunk *c;
+
+	while (list_empty(&log->free_list)) {
+		if (log->nr_chunks < LOG_MAX_CHUNKS) {
+			c = malloc(sizeof(*c));
+			if (c) {
+				log->nr_chunks++;
+				return c;
+			}
+		}
+
+		pthread_cond_wait(&log->cond, &log->lock);
+	}
+
+	c = list_entry(log->free_list.next, struct io_log_chunk, list);
+	list_del(&c->list);
+	return c;
+}
+
+/*
+ * The writer is started from the job itself on the first flush, as a
+ * thread created before fork() would not survive into the job process.
+ */
+static int start_log_writer(struct io_log *log)
+{
+	log->f = fopen(log->file_name, "w");
+	if (!log->f) {
+		perror("fopen log");
+		return 1;
+	}
+
+	if (log->format == LOG_FORMAT_BINARY)
+		fwrite(LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN, 1, log->f);
+
+	if (pthread_create(&log->thread, NULL, log_writer_thread, log)) {
+		perror("pthread_create log");
+		fclose(log->f);
+		log->f = NULL;
+		return 1;
+	}
+
+	log->thread_running = 1;
+	return 0;
+}
+
+/*
+ * Hand the current chunk to the writer thread and start filling a new one.
+ * This only blocks if the writer is LOG_MAX_CHUNKS behind.
+ */
+void flush_log_chunk(struct io_log *log)
+{
+	if (!log->thread_running && !log->error) {
+		if (start_log_writer(log))
+			log->error = 1;
+	}
+
+	if (log->error) {
+		log->nr_samples = 0;
+		return;
+	}
+
+	pthread_mutex_lock(&log->lock);
+	log->chunk->nr_samples = log->nr_samples;
+	list_add_tail(&log->chunk->list, &log->full_list);
+	log->chunk = get_log_chunk(log);
+	pthread_cond_broadcast(&log->cond);
+	pthread_mutex_unlock(&log->lock);
+
+	log->log = log->chunk->samples;
+	log->nr_samples = 0;
+}
+
+int setup_log(struct thread_data *td, struct io_log **log, const char *name)
 {
 	struct io_log *l = malloc(sizeof(*l));
+	char file_name[256];
+
+	if (!l)
+		return 1;
+
+	memset(l, 0, sizeof(*l));
+
+	l->chunk = malloc(sizeof(struct io_log_chunk));
+	if (!l->chunk) {
+		free(l);
+		return 1;
+	}
+
+	snprintf(file_name, 200, "client%d_%s.log%s", td->thread_number, name,
+			td->log_format == LOG_FORMAT_BINARY ? ".bin" : "");
+
+	l->file_name = strdup(file_name);
+	l->format = td->log_format;
+	l->nr_chunks = 1;
+	l->max_samples = LOG_CHUNK_SAMPLES;
+	l->log = l->chunk->samples;
+	INIT_LIST_HEAD(&l->full_list);
+	INIT_LIST_HEAD(&l->free_list);
+	pthread_mutex_init(&l->lock, NULL);
+	pthread_cond_init(&l->cond, NULL);
 
-	l->nr_samples = 0;
-	l->max_samples = 1024;
-	l->log = malloc(l->max_samples * sizeof(struct io_sample));
 	*log = l;
+	return 0;
 }
 
-void finish_log(struct thread_data *td, struct io_log *log, const char *name)
+/*
+ * Write out what is left and wait for the writer to finish.
+ */
+void finish_log(struct io_log *log)
 {
-	char file_name[256];
+	struct io_log_chunk *c;
+
+	flush_log_chunk(log);
+
+	if (log->thread_running) {
+		pthread_mutex_lock(&log->lock);
+		log->exit = 1;
+		pthread_cond_broadcast(&log->cond);
+		pthread_mutex_unlock(&log->lock);
+
+		pthread_join(log->thread, NULL);
+		fclose(log->f);
+	}
+
+	while (!list_empty(&log->free_list)) {
+		c = list_entry(log->free_list.next, struct io_log_chunk, list);
+		list_del(&c->list);
+		free(c);
+	}
+
+	free(log->chunk);
+	free(log->file_name);
+	free(log);
+}
+
+/*
+ * Dump a binary log in the text format, for fio_generate_plots and friends
+ */
+int log_to_text(const char *file_name)
+{
+	char magic[LOG_BINARY_MAGIC_LEN];
+	unsigned long long delta, val, time = 0;
 	FILE *f;
-	unsigned int i;
+	int ddir;
 
-	snprintf(file_name, 200, "client%d_%s.log", td->thread_number, name);
-	f = fopen(file_name, "w");
+	f = fopen(file_name, "r");
 	if (!f) {
 		perror("fopen log");
-		return;
+		return 1;
+	}
+
+	if (fread(magic, LOG_BINARY_MAGIC_LEN, 1, f) != 1 ||
+	    memcmp(magic, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN)) {
+		log_err("fio: %s is not a binary log\n", file_name);
+		fclose(f);
+		return 1;
 	}
 
-	for (i = 0; i < log->nr_samples; i++)
-		fprintf(f, "%lu, %lu, %u\n", log->log[i].time, log->log[i].val, log->log[i].ddir);
+	while (!get_varint(f, &delta)) {
+		if (get_varint(f, &val) || (ddir = getc(f)) == EOF) {
+			log_err("fio: %s is truncated\n", file_name);
+			fclose(f);
+			return 1;
+		}
+
+		time += delta;
+		printf("%llu, %llu, %u\n", time, val, ddir);
+	}
 
 	fclose(f);
-	free(log->log);
-	free(log);
+	return 0;
 }
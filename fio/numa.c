@@ -0,0 +1,225 @@
+/*
+ * NUMA placement of jobs. A job can be restricted to the cpus of a set of
+ * nodes, and get a memory policy for its io buffers and everything else
+ * it allocates. The policy is set before the buffers are allocated and
+ * touched, so they land on the right nodes from the start.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fio.h"
+#include "os.h"
+
+#define NUMA_MAX_NODES	(sizeof(unsigned long) * 8)
+#define NUMA_SYSFS	"/sys/devices/system/node"
+
+typedef int (numa_list_fn)(void *, unsigned int);
+
+/*
+ * Parse a "0,2,4-7" style list, calling fn for each entry
+ */
+static int numa_parse_list(const char *str, numa_list_fn *fn, void *data)
+{
+	const char *p = str;
+	unsigned int start, end;
+	char *endp;
+
+	while (*p && !isspace(*p)) {
+		if (!isdigit(*p))
+			return 1;
+
+		start = end = strtoul(p, &endp, 10);
+		p = endp;
+		if (*p == '-') {
+			p++;
+			if (!isdigit(*p))
+				return 1;
+			end = strtoul(p, &endp, 10);
+			p = endp;
+		}
+
+		if (end < start)
+			return 1;
+
+		for (; start <= end; start++)
+			if (fn(data, start))
+				return 1;
+
+		if (*p == ',')
+			p++;
+	}
+
+	return 0;
+}
+
+static int numa_add_node(void *data, unsigned int node)
+{
+	unsigned long *mask = data;
+
+	if (node >= NUMA_MAX_NODES)
+		return 1;
+
+	*mask |= 1UL << node;
+	return 0;
+}
+
+static int numa_add_cpu(void *data, unsigned int cpu)
+{
+	os_cpu_mask_t *mask = data;
+
+	if (cpu >= CPU_SETSIZE)
+		return 1;
+
+	CPU_SET(cpu, mask);
+	return 0;
+}
+
+int fio_numa_parse_nodes(const char *str, unsigned long *mask)
+{
+	*mask = 0;
+
+	if (numa_parse_list(str, numa_add_node, mask) || !*mask)
+		return 1;
+
+	return 0;
+}
+
+static int numa_read_list(const char *file, numa_list_fn *fn, void *data)
+{
+	char buf[256];
+	FILE *f;
+	int ret = 1;
+
+	f = fopen(file, "r");
+	if (!f)
+		return 1;
+
+	if (fgets(buf, sizeof(buf), f))
+		ret = numa_parse_list(buf, fn, data);
+
+	fclose(f);
+	return ret;
+}
+
+/*
+ * A system without the node directory in sysfs is a single node system
+ */
+static unsigned long numa_online_nodes(void)
+{
+	unsigned long mask = 0;
+
+	if (numa_read_list(NUMA_SYSFS "/online", numa_add_node, &mask) || !mask)
+		mask = 1;
+
+	return mask;
+}
+
+static int numa_node_cpus(unsigned int node, os_cpu_mask_t *mask)
+{
+	char file[128];
+
+	sprintf(file, NUMA_SYSFS "/node%u/cpulist", node);
+	return numa_read_list(file, numa_add_cpu, mask);
+}
+
+/*
+ * Hand out nodes round robin to the jobs that asked for automatic
+ * placement, so numjobs clones end up spread over the machine. Jobs that
+ * didn't set a memory policy get their memory bound to the same node.
+ */
+void fio_numa_spread(void)
+{
+	unsigned long online = numa_online_nodes();
+	struct thread_data *td;
+	unsigned int node = 0;
+	int i;
+
+	for_each_td(td, i) {
+		if (!td->numa_cpunodes_auto)
+			continue;
+
+		while (!(online & (1UL << node)))
+			node = (node + 1) % NUMA_MAX_NODES;
+
+		td->numa_cpunodes = 1UL << node;
+		if (td->numa_mem_mode == NUMA_MEM_NONE) {
+			td->numa_mem_mode = NUMA_MEM_BIND;
+			td->numa_memnodes = 1UL << node;
+		}
+
+		node = (node + 1) % NUMA_MAX_NODES;
+	}
+}
+
+static int numa_set_mempolicy(struct thread_data *td)
+{
+	unsigned long mask = td->numa_memnodes;
+	int mode;
+
+	switch (td->numa_mem_mode) {
+	case NUMA_MEM_DEFAULT:
+		mode = MPOL_DEFAULT;
+		mask = 0;
+		break;
+	case NUMA_MEM_LOCAL:
+		/*
+		 * preferred with an empty node mask is local allocation
+		 */
+		mode = MPOL_PREFERRED;
+		mask = 0;
+		break;
+	case NUMA_MEM_PREFER:
+		mode = MPOL_PREFERRED;
+		break;
+	case NUMA_MEM_BIND:
+		mode = MPOL_BIND;
+		break;
+	case NUMA_MEM_INTERLEAVE:
+		mode = MPOL_INTERLEAVE;
+		if (!mask)
+			mask = numa_online_nodes();
+		break;
+	default:
+		return 0;
+	}
+
+	return fio_set_mempolicy(mode, mask ? &mask : NULL, NUMA_MAX_NODES + 1);
+}
+
+/*
+ * Called from the job itself before it allocates anything. Sets up the
+ * cpu mask from the nodes given, fio_setaffinity() applies it.
+ */
+int fio_numa_setup(struct thread_data *td)
+{
+	unsigned int node;
+
+	if (td->numa_cpunodes) {
+		CPU_ZERO(&td->cpumask);
+
+		for (node = 0; node < NUMA_MAX_NODES; node++) {
+			if (!(td->numa_cpunodes & (1UL << node)))
+				continue;
+			if (numa_node_cpus(node, &td->cpumask)) {
+				log_err("fio: can't get cpus of numa node %u\n", node);
+				td_verror(td, EINVAL);
+				return 1;
+			}
+		}
+
+		if (!CPU_COUNT(&td->cpumask)) {
+			log_err("fio: numa_cpu_nodes has no cpus\n");
+			td_verror(td, EINVAL);
+			return 1;
+		}
+	}
+
+	if (numa_set_mempolicy(td) < 0) {
+		td_verror(td, errno);
+		return 1;
+	}
+
+	return 0;
+}
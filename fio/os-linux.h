@@ -16,9 +16,12 @@
 #define FIO_HAVE_SGIO
 #define FIO_HAVE_IOPRIO
 #define FIO_HAVE_SPLICE
+#define FIO_HAVE_IOURING
 #define FIO_HAVE_IOSCHED_SWITCH
 #define FIO_HAVE_ODIRECT
 #define FIO_HAVE_HUGETLB
+#define FIO_HAVE_NUMA
+#define FIO_HAVE_PWRITEV2
 
 #define OS_MAP_ANON		(MAP_ANONYMOUS)
 
@@ -32,7 +35,7 @@ typedef struct drand48_data os_random_state_t;
 	posix_fadvise((fd), (off_t)(off), (len), (advice))
 
 #define fio_setaffinity(td)		\
-	sched_setaffinity((td)->pid, sizeof((td)->cpumask), &(td)->cpumask)
+	sched_setaffinity(0, sizeof((td)->cpumask), &(td)->cpumask)
 #define fio_getaffinity(pid, ptr)	\
 	sched_getaffinity((pid), sizeof(cpu_set_t), (ptr))
 
@@ -73,6 +76,54 @@ static inline int vmsplice(int fd, const struct iovec *iov,
 
 #define SPLICE_DEF_SIZE	(64*1024)
 
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ	(1031)
+#define F_GETPIPE_SZ	(1032)
+#endif
+
+/*
+ * preadv2/pwritev2 flags, from linux/fs.h
+ */
+#ifndef RWF_HIPRI
+#define RWF_HIPRI	0x00000001	/* poll for completion */
+#endif
+#ifndef RWF_NOWAIT
+#define RWF_NOWAIT	0x00000008	/* return -EAGAIN if io would block */
+#endif
+
+/*
+ * the offset is passed as two longs, the kernel puts them back together
+ */
+static inline long fio_preadv2(int fd, const struct iovec *iov, int iovcnt,
+			       unsigned long long off, int flags)
+{
+	return syscall(__NR_preadv2, fd, iov, iovcnt, (unsigned long) off,
+			(unsigned long) (off >> 32), flags);
+}
+
+static inline long fio_pwritev2(int fd, const struct iovec *iov, int iovcnt,
+				unsigned long long off, int flags)
+{
+	return syscall(__NR_pwritev2, fd, iov, iovcnt, (unsigned long) off,
+			(unsigned long) (off >> 32), flags);
+}
+
+/*
+ * Memory policy modes, from linux/mempolicy.h
+ */
+#ifndef MPOL_DEFAULT
+#define MPOL_DEFAULT		0
+#define MPOL_PREFERRED		1
+#define MPOL_BIND		2
+#define MPOL_INTERLEAVE		3
+#endif
+
+static inline int fio_set_mempolicy(int mode, unsigned long *nodemask,
+				    unsigned long maxnode)
+{
+	return syscall(__NR_set_mempolicy, mode, nodemask, maxnode);
+}
+
 enum {
 	IOPRIO_WHO_PROCESS = 1,
 	IOPRIO_WHO_PGRP,
@@ -19,6 +19,10 @@
 #include <aio.h>
 #endif
 
+#ifdef FIO_HAVE_IOURING
+#include <linux/io_uring.h>
+#endif
+
 #ifdef FIO_HAVE_SGIO
 #include <linux/fs.h>
 #include <scsi/sg.h>
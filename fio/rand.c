@@ -0,0 +1,92 @@
+/*
+ * Fast pseudo random data for io buffers. Not for anything that needs
+ * good statistical quality, the low bits of xoshiro256+ are weak.
+ */
+#include <string.h>
+
+#include "rand.h"
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+/*
+ * splitmix64, to spread a single seed over the whole state
+ */
+static uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+void frand_seed(struct frand_state *fs, uint64_t seed)
+{
+	int i;
+
+	for (i = 0; i < FRAND_LANES; i++) {
+		fs->s0[i] = splitmix64(&seed);
+		fs->s1[i] = splitmix64(&seed);
+		fs->s2[i] = splitmix64(&seed);
+		fs->s3[i] = splitmix64(&seed);
+	}
+}
+
+/*
+ * Step every lane once, storing FRAND_LANES words in out
+ */
+static inline void frand_step(struct frand_state *fs, uint64_t *out)
+{
+	uint64_t t;
+	int i;
+
+	for (i = 0; i < FRAND_LANES; i++) {
+		out[i] = fs->s0[i] + fs->s3[i];
+
+		t = fs->s1[i] << 17;
+		fs->s2[i] ^= fs->s0[i];
+		fs->s3[i] ^= fs->s1[i];
+		fs->s1[i] ^= fs->s2[i];
+		fs->s0[i] ^= fs->s3[i];
+		fs->s2[i] ^= t;
+		fs->s3[i] = rotl64(fs->s3[i], 45);
+	}
+}
+
+/*
+ * Single value, from the first lane only
+ */
+uint64_t frand_next(struct frand_state *fs)
+{
+	uint64_t ret = fs->s0[0] + fs->s3[0];
+	uint64_t t = fs->s1[0] << 17;
+
+	fs->s2[0] ^= fs->s0[0];
+	fs->s3[0] ^= fs->s1[0];
+	fs->s1[0] ^= fs->s2[0];
+	fs->s0[0] ^= fs->s3[0];
+	fs->s2[0] ^= t;
+	fs->s3[0] = rotl64(fs->s3[0], 45);
+	return ret;
+}
+
+void fill_random_buf(struct frand_state *fs, void *buf, unsigned int len)
+{
+	uint64_t out[FRAND_LANES];
+	unsigned char *p = buf;
+
+	while (len >= sizeof(out)) {
+		frand_step(fs, out);
+		memcpy(p, out, sizeof(out));
+		p += sizeof(out);
+		len -= sizeof(out);
+	}
+
+	if (len) {
+		frand_step(fs, out);
+		memcpy(p, out, len);
+	}
+}
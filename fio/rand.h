@@ -0,0 +1,23 @@
+#ifndef FIO_RAND_H
+#define FIO_RAND_H
+
+#include <stdint.h>
+
+/*
+ * xoshiro256+ generator, run as FRAND_LANES independent streams side by
+ * side so buffer fills can be vectorised by the compiler.
+ */
+#define FRAND_LANES	4
+
+struct frand_state {
+	uint64_t s0[FRAND_LANES];
+	uint64_t s1[FRAND_LANES];
+	uint64_t s2[FRAND_LANES];
+	uint64_t s3[FRAND_LANES];
+};
+
+extern void frand_seed(struct frand_state *, uint64_t);
+extern uint64_t frand_next(struct frand_state *);
+extern void fill_random_buf(struct frand_state *, void *, unsigned int);
+
+#endif
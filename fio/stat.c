@@ -6,6 +6,8 @@
 #include <dirent.h>
 #include <libgen.h>
 #include <math.h>
+#include <errno.h>
+#include <limits.h>
 
 #include "fio.h"
 
@@ -41,7 +43,7 @@ static int get_io_ticks(struct disk_util *du, struct disk_util_stat *dus)
 static void update_io_tick_disk(struct disk_util *du)
 {
 	struct disk_util_stat __dus, *dus, *ldus;
-	struct timeval t;
+	struct timespec t;
 
 	if (get_io_ticks(du, &__dus))
 		return;
@@ -260,32 +262,134 @@ void update_rusage_stat(struct thread_data *td)
 {
 	getrusage(RUSAGE_SELF, &td->ru_end);
 
-	td->usr_time += mtime_since(&td->ru_start.ru_utime, &td->ru_end.ru_utime);
-	td->sys_time += mtime_since(&td->ru_start.ru_stime, &td->ru_end.ru_stime);
+	td->usr_time += mtime_since_tv(&td->ru_start.ru_utime, &td->ru_end.ru_utime);
+	td->sys_time += mtime_since_tv(&td->ru_start.ru_stime, &td->ru_end.ru_stime);
 	td->ctx += td->ru_end.ru_nvcsw + td->ru_end.ru_nivcsw - (td->ru_start.ru_nvcsw + td->ru_start.ru_nivcsw);
 
 	
 	memcpy(&td->ru_start, &td->ru_end, sizeof(td->ru_end));
 }
 
-static int calc_lat(struct io_stat *is, unsigned long *min, unsigned long *max,
-		    double *mean, double *dev)
+static int calc_lat(struct io_stat *is, unsigned long long *min,
+		    unsigned long long *max, double *mean, double *dev)
 {
-	double n;
-
 	if (is->samples == 0)
 		return 0;
 
 	*min = is->min_val;
 	*max = is->max_val;
+	*mean = is->mean;
 
-	n = (double) is->samples;
-	*mean = (double) is->val / n;
-	*dev = sqrt(((double) is->val_sq - (*mean * *mean) / n) / (n - 1));
+	if (is->samples > 1)
+		*dev = sqrt(is->S / (is->samples - 1));
+	else
+		*dev = 0.0;
 
 	return 1;
 }
 
+/*
+ * Latencies are sampled in nsecs, pick a unit that keeps the shown values
+ * readable without rounding small ones to 0.
+ */
+static const char *lat_unit(unsigned long long max, unsigned long *div)
+{
+	if (max < 10000ULL) {
+		*div = 1;
+		return "nsec";
+	} else if (max < 10000000ULL) {
+		*div = 1000;
+		return "usec";
+	}
+
+	*div = 1000000;
+	return "msec";
+}
+
+/*
+ * Percentiles shown for the latency histograms
+ */
+static const double plat_percentiles[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+#define PLAT_PERCENTILES_NR	\
+	(sizeof(plat_percentiles) / sizeof(plat_percentiles[0]))
+
+/*
+ * Map a histogram bucket back to the middle of the value range it covers.
+ */
+static unsigned long long plat_idx_to_val(unsigned int idx)
+{
+	unsigned int error_bits, k;
+	unsigned long long base;
+
+	if (idx < (FIO_IO_U_PLAT_VAL << 1))
+		return idx;
+
+	error_bits = (idx >> FIO_IO_U_PLAT_BITS) - 1;
+	base = 1ULL << (error_bits + FIO_IO_U_PLAT_BITS);
+	k = idx % FIO_IO_U_PLAT_VAL;
+
+	return base + ((k + 0.5) * (1ULL << error_bits));
+}
+
+/*
+ * Fill in the value at each of plat_percentiles[], walking the histogram
+ * once. Returns 0 if there are no samples.
+ */
+static int calc_plat(unsigned int *plat, unsigned long long *ovals)
+{
+	unsigned long long nr = 0, sum = 0;
+	unsigned int i, j = 0;
+
+	for (i = 0; i < FIO_IO_U_PLAT_NR; i++)
+		nr += plat[i];
+
+	if (!nr)
+		return 0;
+
+	for (i = 0; i < FIO_IO_U_PLAT_NR && j < PLAT_PERCENTILES_NR; i++) {
+		sum += plat[i];
+		while (j < PLAT_PERCENTILES_NR &&
+		       sum >= plat_percentiles[j] * nr / 100.0)
+			ovals[j++] = plat_idx_to_val(i);
+	}
+
+	return 1;
+}
+
+static void show_lat(struct io_stat *is, unsigned int *plat, const char *name)
+{
+	unsigned long long min, max, ovals[PLAT_PERCENTILES_NR];
+	unsigned long div;
+	const char *unit;
+	double mean, dev;
+	unsigned int i;
+
+	if (!calc_lat(is, &min, &max, &mean, &dev))
+		return;
+
+	unit = lat_unit(max, &div);
+	fprintf(f_out, "    %s (%s): min=%5llu, max=%5llu, avg=%5.02f, dev=%5.02f\n", name, unit, min / div, max / div, mean / div, dev / div);
+
+	if (!calc_plat(plat, ovals))
+		return;
+
+	fprintf(f_out, "    %s percentiles (%s):", name, unit);
+	for (i = 0; i < PLAT_PERCENTILES_NR; i++)
+		fprintf(f_out, " %gth=%llu%c", plat_percentiles[i], ovals[i] / div, i == PLAT_PERCENTILES_NR - 1 ? '\n' : ',');
+}
+
+static void show_plat_terse(unsigned int *plat)
+{
+	unsigned long long ovals[PLAT_PERCENTILES_NR];
+	unsigned int i;
+
+	if (!calc_plat(plat, ovals))
+		memset(ovals, 0, sizeof(ovals));
+
+	for (i = 0; i < PLAT_PERCENTILES_NR; i++)
+		fprintf(f_out, ",%llu", ovals[i]);
+}
+
 static void show_group_stats(struct group_run_stats *rs, int id)
 {
 	fprintf(f_out, "\nRun status group %d (all jobs):\n", id);
@@ -331,7 +435,7 @@ static void show_ddir_status(struct thread_data *td, struct group_run_stats *rs,
 			     int ddir)
 {
 	const char *ddir_str[] = { "read ", "write" };
-	unsigned long min, max;
+	unsigned long long min, max;
 	unsigned long long bw;
 	double mean, dev;
 
@@ -341,17 +445,14 @@ static void show_ddir_status(struct thread_data *td, struct group_run_stats *rs,
 	bw = td->io_bytes[ddir] / td->runtime[ddir];
 	fprintf(f_out, "  %s: io=%6lluMiB, bw=%6lluKiB/s, runt=%6lumsec\n", ddir_str[ddir], td->io_bytes[ddir] >> 20, bw, td->runtime[ddir]);
 
-	if (calc_lat(&td->slat_stat[ddir], &min, &max, &mean, &dev))
-		fprintf(f_out, "    slat (msec): min=%5lu, max=%5lu, avg=%5.02f, dev=%5.02f\n", min, max, mean, dev);
-
-	if (calc_lat(&td->clat_stat[ddir], &min, &max, &mean, &dev))
-		fprintf(f_out, "    clat (msec): min=%5lu, max=%5lu, avg=%5.02f, dev=%5.02f\n", min, max, mean, dev);
+	show_lat(&td->slat_stat[ddir], td->slat_plat[ddir], "slat");
+	show_lat(&td->clat_stat[ddir], td->clat_plat[ddir], "clat");
 
 	if (calc_lat(&td->bw_stat[ddir], &min, &max, &mean, &dev)) {
 		double p_of_agg;
 
 		p_of_agg = mean * 100 / (double) rs->agg[ddir];
-		fprintf(f_out, "    bw (KiB/s) : min=%5lu, max=%5lu, per=%3.2f%%, avg=%5.02f, dev=%5.02f\n", min, max, p_of_agg, mean, dev);
+		fprintf(f_out, "    bw (KiB/s) : min=%5llu, max=%5llu, per=%3.2f%%, avg=%5.02f, dev=%5.02f\n", min, max, p_of_agg, mean, dev);
 	}
 }
 
@@ -370,7 +471,7 @@ static void show_thread_status(struct thread_data *td,
 	if (td->io_bytes[td->ddir ^ 1])
 		show_ddir_status(td, rs, td->ddir ^ 1);
 
-	runtime = mtime_since(&td->epoch, &td->end_time);
+	runtime = mtime_since(&td->epoch, &td->end_time) - td->ramp_msec;
 	if (runtime) {
 		double runt = (double) runtime;
 
@@ -382,13 +483,22 @@ static void show_thread_status(struct thread_data *td,
 	}
 
 	fprintf(f_out, "  cpu          : usr=%3.2f%%, sys=%3.2f%%, ctx=%lu\n", usr_cpu, sys_cpu, td->ctx);
+
+	if (td->first_io_done)
+		fprintf(f_out, "  startup      : ready=%lumsec, first io=%lumsec\n", td->startup_msec, td->first_io_msec);
+
+	if (td->ss_dur) {
+		if (td->ss_attained)
+			fprintf(f_out, "  steadystate  : attained after %lusec\n", td->ss_msec / 1000);
+		else
+			fprintf(f_out, "  steadystate  : not attained\n");
+	}
 }
 
 static void show_ddir_status_terse(struct thread_data *td,
 				   struct group_run_stats *rs, int ddir)
 {
-	unsigned long min, max;
-	unsigned long long bw;
+	unsigned long long min, max, bw;
 	double mean, dev;
 
 	bw = 0;
@@ -398,23 +508,25 @@ static void show_ddir_status_terse(struct thread_data *td,
 	fprintf(f_out, ",%llu,%llu,%lu", td->io_bytes[ddir] >> 10, bw, td->runtime[ddir]);
 
 	if (calc_lat(&td->slat_stat[ddir], &min, &max, &mean, &dev))
-		fprintf(f_out, ",%lu,%lu,%f,%f", min, max, mean, dev);
+		fprintf(f_out, ",%llu,%llu,%f,%f", min, max, mean, dev);
 	else
-		fprintf(f_out, ",%lu,%lu,%f,%f", 0UL, 0UL, 0.0, 0.0);
+		fprintf(f_out, ",%llu,%llu,%f,%f", 0ULL, 0ULL, 0.0, 0.0);
 
 	if (calc_lat(&td->clat_stat[ddir], &min, &max, &mean, &dev))
-		fprintf(f_out, ",%lu,%lu,%f,%f", min, max, mean, dev);
+		fprintf(f_out, ",%llu,%llu,%f,%f", min, max, mean, dev);
 	else
-		fprintf(f_out, ",%lu,%lu,%f,%f", 0UL, 0UL, 0.0, 0.0);
+		fprintf(f_out, ",%llu,%llu,%f,%f", 0ULL, 0ULL, 0.0, 0.0);
 
 	if (calc_lat(&td->bw_stat[ddir], &min, &max, &mean, &dev)) {
 		double p_of_agg;
 
 		p_of_agg = mean * 100 / (double) rs->agg[ddir];
-		fprintf(f_out, ",%lu,%lu,%f%%,%f,%f", min, max, p_of_agg, mean, dev);
+		fprintf(f_out, ",%llu,%llu,%f%%,%f,%f", min, max, p_of_agg, mean, dev);
 	} else
-		fprintf(f_out, ",%lu,%lu,%f%%,%f,%f", 0UL, 0UL, 0.0, 0.0, 0.0);
-		
+		fprintf(f_out, ",%llu,%llu,%f%%,%f,%f", 0ULL, 0ULL, 0.0, 0.0, 0.0);
+
+	show_plat_terse(td->slat_plat[ddir]);
+	show_plat_terse(td->clat_plat[ddir]);
 }
 
 
@@ -529,27 +641,232 @@ void show_run_stats(void)
 	free(runstats);
 }
 
-static inline void add_stat_sample(struct io_stat *is, unsigned long val)
+/*
+ * Publish the running totals for the main thread. Called from the job on
+ * completions, at most every DISK_UTIL_MSEC, or with a NULL time to force
+ * a final update on exit.
+ */
+void update_io_snapshot(struct thread_data *td, struct timespec *now)
+{
+	struct io_snapshot *snap = &td->snap;
+
+	if (now) {
+		if (mtime_since(&td->snap_time, now) < DISK_UTIL_MSEC)
+			return;
+		td->snap_time = *now;
+	}
+
+	snap->seq++;
+	write_barrier();
+
+	snap->reset = td->ramp_time_over;
+	memcpy(snap->io_bytes, td->io_bytes, sizeof(snap->io_bytes));
+	memcpy(snap->io_blocks, td->io_blocks, sizeof(snap->io_blocks));
+	memcpy(snap->clat_plat, td->clat_plat, sizeof(snap->clat_plat));
+
+	write_barrier();
+	snap->seq++;
+}
+
+/*
+ * The main thread keeps the last snapshot seen for each job, and sums up
+ * the difference per group on every interval.
+ */
+struct group_interval_stats {
+	unsigned long long io_bytes[2];
+	unsigned long long io_blocks[2];
+	unsigned int clat_plat[2][FIO_IO_U_PLAT_NR];
+};
+
+static struct io_snapshot *prev_snaps;
+static struct io_snapshot snap_copy;
+static struct group_interval_stats *interval_stats;
+static struct timespec interval_time;
+
+void init_interval_stats(void)
+{
+	prev_snaps = calloc(thread_number, sizeof(struct io_snapshot));
+	interval_stats = calloc(groupid + 1, sizeof(struct group_interval_stats));
+	if (!prev_snaps || !interval_stats) {
+		log_err("fio: no memory for interval stats\n");
+		free(prev_snaps);
+		free(interval_stats);
+		prev_snaps = NULL;
+		interval_stats = NULL;
+		return;
+	}
+
+	fill_start_time(&interval_time);
+}
+
+/*
+ * Copy out a consistent snapshot, without stopping the job
+ */
+static void read_io_snapshot(struct io_snapshot *snap, struct io_snapshot *dst)
+{
+	unsigned int seq;
+
+	do {
+		seq = snap->seq;
+		read_barrier();
+		memcpy(dst, snap, sizeof(*dst));
+		read_barrier();
+	} while ((seq & 1) || seq != snap->seq);
+}
+
+static void show_group_interval(struct group_interval_stats *gis, int gid,
+				int ddir, unsigned long msec)
+{
+	const char *ddir_str[] = { "read", "write" };
+	unsigned long long ovals[PLAT_PERCENTILES_NR];
+	unsigned long long iops, bw;
+	unsigned long div;
+	const char *unit;
+	unsigned int i;
+
+	iops = gis->io_blocks[ddir] * 1000 / msec;
+	bw = gis->io_bytes[ddir] / msec;
+
+	if (!calc_plat(gis->clat_plat[ddir], ovals))
+		memset(ovals, 0, sizeof(ovals));
+
+	if (terse_output) {
+		fprintf(f_out, "interval,%lu,%d,%s,%llu,%llu", mtime_since_genesis(), gid, ddir_str[ddir], iops, bw);
+		for (i = 0; i < PLAT_PERCENTILES_NR; i++)
+			fprintf(f_out, ",%llu", ovals[i]);
+		fprintf(f_out, "\n");
+		return;
+	}
+
+	unit = lat_unit(ovals[PLAT_PERCENTILES_NR - 1], &div);
+	fprintf(f_out, "[%lus] group %d %5s: iops=%llu, bw=%lluKiB/s, clat (%s):", mtime_since_genesis() / 1000, gid, ddir_str[ddir], iops, bw, unit);
+	for (i = 0; i < PLAT_PERCENTILES_NR; i++)
+		fprintf(f_out, " %gth=%llu%c", plat_percentiles[i], ovals[i] / div, i == PLAT_PERCENTILES_NR - 1 ? '\n' : ',');
+}
+
+/*
+ * Called from the main thread every status tick. Once status_interval has
+ * passed, diff each job against its last snapshot and show the groups.
+ */
+void show_interval_stats(void)
 {
+	struct group_interval_stats *gis;
+	struct io_snapshot *prev, *cur = &snap_copy;
+	struct thread_data *td;
+	unsigned long msec;
+	int i, j, ddir;
+
+	if (!interval_stats)
+		return;
+
+	msec = mtime_since_now(&interval_time);
+	if (msec < status_interval * 1000)
+		return;
+
+	fio_gettime(&interval_time, NULL);
+	memset(interval_stats, 0, (groupid + 1) * sizeof(*interval_stats));
+
+	for_each_td(td, i) {
+		prev = &prev_snaps[i];
+		gis = &interval_stats[td->groupid];
+
+		read_io_snapshot(&td->snap, cur);
+
+		/*
+		 * the job threw away its stats at the end of ramp_time
+		 */
+		if (cur->reset != prev->reset)
+			memset(prev, 0, sizeof(*prev));
+
+		for (ddir = 0; ddir <= DDIR_WRITE; ddir++) {
+			gis->io_bytes[ddir] += cur->io_bytes[ddir] - prev->io_bytes[ddir];
+			gis->io_blocks[ddir] += cur->io_blocks[ddir] - prev->io_blocks[ddir];
+			for (j = 0; j < FIO_IO_U_PLAT_NR; j++)
+				gis->clat_plat[ddir][j] += cur->clat_plat[ddir][j] - prev->clat_plat[ddir][j];
+		}
+
+		memcpy(prev, cur, sizeof(*prev));
+	}
+
+	for (i = 0; i < groupid + 1; i++) {
+		gis = &interval_stats[i];
+
+		for (ddir = 0; ddir <= DDIR_WRITE; ddir++)
+			if (gis->io_blocks[ddir])
+				show_group_interval(gis, i, ddir, msec);
+	}
+
+	fflush(f_out);
+}
+
+static inline void add_stat_sample(struct io_stat *is, unsigned long long val)
+{
+	double delta;
+
 	if (val > is->max_val)
 		is->max_val = val;
 	if (val < is->min_val)
 		is->min_val = val;
 
-	is->val += val;
-	is->val_sq += val * val;
 	is->samples++;
+	delta = (double) val - is->mean;
+	is->mean += delta / is->samples;
+	is->S += delta * ((double) val - is->mean);
 }
 
-static void add_log_sample(struct thread_data *td, struct io_log *iolog,
-			   unsigned long val, enum fio_ddir ddir)
+/*
+ * Find the histogram bucket for a value. Small values index directly, above
+ * that the msb picks the group and the FIO_IO_U_PLAT_BITS bits below it pick
+ * the bucket within the group.
+ */
+static unsigned int plat_val_to_idx(unsigned long long val)
 {
-	if (iolog->nr_samples == iolog->max_samples) {
-		int new_size = sizeof(struct io_sample) * iolog->max_samples*2;
+	unsigned int msb, error_bits, base, offset, idx;
+	unsigned long long v = val;
+
+	if (val < (FIO_IO_U_PLAT_VAL << 1))
+		return val;
 
-		iolog->log = realloc(iolog->log, new_size);
-		iolog->max_samples <<= 1;
+	msb = 0;
+	if (v >> 32) {
+		msb += 32;
+		v >>= 32;
+	}
+	if (v >> 16) {
+		msb += 16;
+		v >>= 16;
+	}
+	if (v >> 8) {
+		msb += 8;
+		v >>= 8;
+	}
+	if (v >> 4) {
+		msb += 4;
+		v >>= 4;
 	}
+	if (v >> 2) {
+		msb += 2;
+		v >>= 2;
+	}
+	if (v >> 1)
+		msb++;
+
+	error_bits = msb - FIO_IO_U_PLAT_BITS;
+	base = (error_bits + 1) << FIO_IO_U_PLAT_BITS;
+	offset = (FIO_IO_U_PLAT_VAL - 1) & (val >> error_bits);
+
+	idx = base + offset;
+	if (idx > FIO_IO_U_PLAT_NR - 1)
+		idx = FIO_IO_U_PLAT_NR - 1;
+
+	return idx;
+}
+
+static void add_log_sample(struct thread_data *td, struct io_log *iolog,
+			   unsigned long long val, enum fio_ddir ddir)
+{
+	if (iolog->nr_samples == iolog->max_samples)
+		flush_log_chunk(iolog);
 
 	iolog->log[iolog->nr_samples].val = val;
 	iolog->log[iolog->nr_samples].time = mtime_since_now(&td->epoch);
@@ -558,30 +875,38 @@ static void add_log_sample(struct thread_data *td, struct io_log *iolog,
 }
 
 void add_clat_sample(struct thread_data *td, enum fio_ddir ddir,
-		     unsigned long msec)
+		     unsigned long long nsec)
 {
-	add_stat_sample(&td->clat_stat[ddir], msec);
+	if (!td->ramp_time_over)
+		return;
+
+	add_stat_sample(&td->clat_stat[ddir], nsec);
+	td->clat_plat[ddir][plat_val_to_idx(nsec)]++;
 
 	if (td->clat_log)
-		add_log_sample(td, td->clat_log, msec, ddir);
+		add_log_sample(td, td->clat_log, nsec, ddir);
 }
 
 void add_slat_sample(struct thread_data *td, enum fio_ddir ddir,
-		     unsigned long msec)
+		     unsigned long long nsec)
 {
-	add_stat_sample(&td->slat_stat[ddir], msec);
+	if (!td->ramp_time_over)
+		return;
+
+	add_stat_sample(&td->slat_stat[ddir], nsec);
+	td->slat_plat[ddir][plat_val_to_idx(nsec)]++;
 
 	if (td->slat_log)
-		add_log_sample(td, td->slat_log, msec, ddir);
+		add_log_sample(td, td->slat_log, nsec, ddir);
 }
 
 void add_bw_sample(struct thread_data *td, enum fio_ddir ddir,
-		   struct timeval *t)
+		   struct timespec *t)
 {
 	unsigned long spent = mtime_since(&td->stat_sample_time[ddir], t);
 	unsigned long rate;
 
-	if (spent < td->bw_avg_time)
+	if (!td->ramp_time_over || spent < td->bw_avg_time)
 		return;
 
 	rate = (td->this_io_bytes[ddir] - td->stat_io_bytes[ddir]) / spent;
@@ -595,3 +920,143 @@ void add_bw_sample(struct thread_data *td, enum fio_ddir ddir,
 }
 
 
+
+/*
+ * Called once ramp_time is over. Everything accounted so far is thrown
+ * away, so the results only cover the part of the job that was up to
+ * speed. Runtime and cpu usage count from here as well.
+ */
+void reset_io_stats(struct thread_data *td)
+{
+	struct timespec now;
+	int i;
+
+	fio_gettime(&now, NULL);
+
+	td->ramp_bytes = td->io_bytes[0] + td->io_bytes[1];
+	td->ramp_msec = mtime_since(&td->epoch, &now);
+
+	for (i = 0; i <= DDIR_WRITE; i++) {
+		td->io_bytes[i] = td->io_blocks[i] = 0;
+
+		memset(&td->clat_stat[i], 0, sizeof(struct io_stat));
+		memset(&td->slat_stat[i], 0, sizeof(struct io_stat));
+		memset(&td->bw_stat[i], 0, sizeof(struct io_stat));
+		td->clat_stat[i].min_val = ULLONG_MAX;
+		td->slat_stat[i].min_val = ULLONG_MAX;
+		td->bw_stat[i].min_val = ULLONG_MAX;
+
+		td->stat_io_bytes[i] = td->this_io_bytes[i];
+		memcpy(&td->stat_sample_time[i], &now, sizeof(now));
+	}
+
+	memset(td->clat_plat, 0, sizeof(td->clat_plat));
+	memset(td->slat_plat, 0, sizeof(td->slat_plat));
+
+	memcpy(&td->start, &now, sizeof(now));
+	update_rusage_stat(td);
+	td->usr_time = td->sys_time = td->ctx = 0;
+
+	memcpy(&td->ss_time, &now, sizeof(now));
+	td->ss_last_bytes = td->ss_last_blocks = 0;
+	td->ss_head = td->ss_nr = 0;
+
+	td->ramp_time_over = 1;
+	if (status_interval)
+		update_io_snapshot(td, NULL);
+}
+
+int steadystate_init(struct thread_data *td)
+{
+	td->ss_samples = malloc(td->ss_dur * sizeof(double));
+	if (!td->ss_samples) {
+		td_verror(td, ENOMEM);
+		return 1;
+	}
+
+	fio_gettime(&td->ss_time, NULL);
+	td->ss_last_bytes = td->io_bytes[0] + td->io_bytes[1];
+	td->ss_last_blocks = td->io_blocks[0] + td->io_blocks[1];
+	td->ss_head = td->ss_nr = 0;
+	td->ss_attained = 0;
+	return 0;
+}
+
+/*
+ * Take a sample of the iops or bandwidth once a second. When the window is
+ * full, the metric is steady if no sample is further from the mean than
+ * the limit, or for the slope variants, if the least squares slope of the
+ * window (per second) is within the limit. Returns 1 once steady.
+ */
+int steadystate_check(struct thread_data *td, struct timespec *now)
+{
+	unsigned long long bytes, blocks;
+	double val, mean, limit, dev, sxy, sxx, x;
+	unsigned long msec;
+	unsigned int i, j;
+
+	if (!td->ramp_time_over)
+		return 0;
+
+	msec = mtime_since(&td->ss_time, now);
+	if (msec < 1000)
+		return 0;
+
+	bytes = td->io_bytes[0] + td->io_bytes[1];
+	blocks = td->io_blocks[0] + td->io_blocks[1];
+	if (td->ss_metric & SS_IOPS)
+		val = (double) (blocks - td->ss_last_blocks) * 1000.0 / msec;
+	else
+		val = (double) (bytes - td->ss_last_bytes) / 1024.0 * 1000.0 / msec;
+
+	td->ss_last_bytes = bytes;
+	td->ss_last_blocks = blocks;
+	memcpy(&td->ss_time, now, sizeof(*now));
+
+	td->ss_samples[td->ss_head] = val;
+	td->ss_head = (td->ss_head + 1) % td->ss_dur;
+	if (td->ss_nr < td->ss_dur)
+		td->ss_nr++;
+	if (td->ss_nr < td->ss_dur)
+		return 0;
+
+	mean = 0.0;
+	for (i = 0; i < td->ss_nr; i++)
+		mean += td->ss_samples[i];
+	mean /= td->ss_nr;
+
+	/*
+	 * a job that isn't doing any io isn't steady, it's stuck
+	 */
+	if (mean <= 0.0)
+		return 0;
+
+	limit = td->ss_limit;
+	if (td->ss_metric & SS_PCT)
+		limit = limit * mean / 100.0;
+
+	if (td->ss_metric & SS_SLOPE) {
+		/*
+		 * oldest sample is at the head of the ring
+		 */
+		sxy = sxx = 0.0;
+		for (i = 0; i < td->ss_nr; i++) {
+			j = (td->ss_head + i) % td->ss_dur;
+			x = (double) i - (td->ss_nr - 1) / 2.0;
+			sxy += x * (td->ss_samples[j] - mean);
+			sxx += x * x;
+		}
+		if (sxx > 0.0 && fabs(sxy / sxx) > limit)
+			return 0;
+	} else {
+		for (i = 0; i < td->ss_nr; i++) {
+			dev = fabs(td->ss_samples[i] - mean);
+			if (dev > limit)
+				return 0;
+		}
+	}
+
+	td->ss_attained = 1;
+	td->ss_msec = mtime_since(&td->epoch, now) - td->ramp_msec;
+	return 1;
+}
@@ -1,71 +1,94 @@
 #include <time.h>
+#include <math.h>
 #include <sys/time.h>
 
 #include "fio.h"
 
-static struct timeval genesis;
+static struct timespec genesis;
 
-unsigned long utime_since(struct timeval *s, struct timeval *e)
+unsigned long long ntime_since(struct timespec *s, struct timespec *e)
 {
-	long sec, usec;
+	long long sec, nsec;
 
 	sec = e->tv_sec - s->tv_sec;
-	usec = e->tv_usec - s->tv_usec;
-	if (sec > 0 && usec < 0) {
+	nsec = e->tv_nsec - s->tv_nsec;
+	if (sec > 0 && nsec < 0) {
 		sec--;
-		usec += 1000000;
+		nsec += 1000000000LL;
 	}
 
-	sec *= (double) 1000000;
+	if (sec < 0 || (sec == 0 && nsec < 0))
+		return 0;
 
-	return sec + usec;
+	return sec * 1000000000ULL + nsec;
 }
 
-unsigned long utime_since_now(struct timeval *s)
+unsigned long long ntime_since_now(struct timespec *s)
 {
-	struct timeval t;
+	struct timespec t;
 
 	fio_gettime(&t, NULL);
-	return utime_since(s, &t);
+	return ntime_since(s, &t);
 }
 
-unsigned long mtime_since(struct timeval *s, struct timeval *e)
+unsigned long utime_since(struct timespec *s, struct timespec *e)
 {
-	long sec, usec;
+	return ntime_since(s, e) / 1000;
+}
 
-	sec = e->tv_sec - s->tv_sec;
-	usec = e->tv_usec - s->tv_usec;
-	if (sec > 0 && usec < 0) {
-		sec--;
-		usec += 1000000;
-	}
+unsigned long utime_since_now(struct timespec *s)
+{
+	struct timespec t;
 
-	sec *= (double) 1000;
-	usec /= (double) 1000;
+	fio_gettime(&t, NULL);
+	return utime_since(s, &t);
+}
 
-	return sec + usec;
+unsigned long mtime_since(struct timespec *s, struct timespec *e)
+{
+	return ntime_since(s, e) / 1000000;
 }
 
-unsigned long mtime_since_now(struct timeval *s)
+unsigned long mtime_since_now(struct timespec *s)
 {
-	struct timeval t;
+	struct timespec t;
 	void *p = __builtin_return_address(0);
 
 	fio_gettime(&t, p);
 	return mtime_since(s, &t);
 }
 
-unsigned long time_since_now(struct timeval *s)
+unsigned long time_since_now(struct timespec *s)
 {
 	return mtime_since_now(s) / 1000;
 }
 
+/*
+ * For timevals we don't sample ourselves, like rusage times
+ */
+unsigned long mtime_since_tv(struct timeval *s, struct timeval *e)
+{
+	long sec, usec;
+
+	sec = e->tv_sec - s->tv_sec;
+	usec = e->tv_usec - s->tv_usec;
+	if (sec > 0 && usec < 0) {
+		sec--;
+		usec += 1000000;
+	}
+
+	sec *= (double) 1000;
+	usec /= (double) 1000;
+
+	return sec + usec;
+}
+
 /*
  * busy looping version for the last few usec
  */
 void __usec_sleep(unsigned int usec)
 {
-	struct timeval start;
+	struct timespec start;
 
 	fio_gettime(&start, NULL);
 	while (utime_since_now(&start) < usec)
@@ -107,7 +130,7 @@ void rate_throttle(struct thread_data *td, unsigned long time_spent,
 	if (!td->rate)
 		return;
 
-	usec_cycle = td->rate_usec_cycle * (bytes / td->min_bs[ddir]);
+	usec_cycle = td->rate_usec_cycle[ddir] * (bytes / td->min_bs[ddir]);
 
 	if (time_spent < usec_cycle) {
 		unsigned long s = usec_cycle - time_spent;
@@ -124,17 +147,120 @@ void rate_throttle(struct thread_data *td, unsigned long time_spent,
 	}
 }
 
+/*
+ * Open loop rate control. Each data direction has its own schedule of
+ * arrivals, set by rate_iops or rate_bw, and an io is issued when it is
+ * due whether or not earlier ios have completed. A direction without a
+ * target is always due, it gets what the other one leaves.
+ */
+void rate_open_init(struct thread_data *td)
+{
+	fio_gettime(&td->rate_start, NULL);
+	td->rate_next[DDIR_READ] = td->rate_next[DDIR_WRITE] = 0;
+}
+
+/*
+ * Pick the direction of the next io, returns the nsecs until it is due
+ */
+unsigned long long rate_open_next(struct thread_data *td)
+{
+	unsigned long long now, due[2];
+	int ddir;
+
+	now = ntime_since_now(&td->rate_start);
+
+	for (ddir = DDIR_READ; ddir <= DDIR_WRITE; ddir++) {
+		if (td->rate_iops[ddir] || td->rate_bw[ddir])
+			due[ddir] = td->rate_next[ddir];
+		else
+			due[ddir] = now;
+	}
+
+	if (td_rw(td))
+		ddir = due[DDIR_WRITE] < due[DDIR_READ] ? DDIR_WRITE : DDIR_READ;
+	else if (td_read(td))
+		ddir = DDIR_READ;
+	else
+		ddir = DDIR_WRITE;
+
+	td->rate_ddir = ddir;
+	td->rate_due = due[ddir];
+
+	if (due[ddir] <= now)
+		return 0;
+
+	return due[ddir] - now;
+}
+
+/*
+ * The io_u is issued for the arrival that rate_open_next() waited for.
+ * Time it from when it was due, so a backlog shows up as latency rather
+ * than being hidden by a late start, and schedule the next one.
+ */
+void rate_open_arrival(struct thread_data *td, struct io_u *io_u)
+{
+	unsigned long long nsec;
+	enum fio_ddir ddir = io_u->ddir;
+	double mean, u;
+
+	if (ddir == DDIR_SYNC)
+		return;
+
+	nsec = td->rate_start.tv_nsec + td->rate_due;
+	io_u->start_time.tv_sec = td->rate_start.tv_sec + nsec / 1000000000ULL;
+	io_u->start_time.tv_nsec = nsec % 1000000000ULL;
+
+	if (td->rate_iops[ddir])
+		mean = 1000000000.0 / td->rate_iops[ddir];
+	else if (td->rate_bw[ddir])
+		mean = io_u->buflen * 1000000000.0 / (td->rate_bw[ddir] * 1024.0);
+	else
+		return;
+
+	if (td->rate_process == RATE_PROCESS_POISSON) {
+		u = (frand_next(&td->rate_state) >> 11) / 9007199254740992.0;
+		mean = -log(1.0 - u) * mean;
+	}
+
+	td->rate_next[ddir] += mean;
+}
+
+/*
+ * nanosleep() up to rate_spin usecs before the arrival, then busy wait the
+ * rest. nanosleep() alone tends to oversleep by about that much.
+ */
+void rate_open_sleep(struct thread_data *td, unsigned long long nsec)
+{
+	unsigned long long spin = td->rate_spin * 1000ULL;
+	struct timespec req, start;
+
+	if (nsec > spin) {
+		nsec -= spin;
+		req.tv_sec = nsec / 1000000000ULL;
+		req.tv_nsec = nsec % 1000000000ULL;
+		nanosleep(&req, NULL);
+		return;
+	}
+
+	fio_gettime(&start, NULL);
+	while (ntime_since_now(&start) < nsec && !td->terminate)
+		nop;
+}
+
 unsigned long mtime_since_genesis(void)
 {
 	return mtime_since_now(&genesis);
 }
 
-static void fio_init time_init(void)
+/*
+ * Called once the clock source is settled, everything is timed from here
+ */
+void fio_time_init(void)
 {
 	fio_gettime(&genesis, NULL);
 }
 
-void fill_start_time(struct timeval *t)
+void fill_start_time(struct timespec *t)
 {
 	memcpy(t, &genesis, sizeof(genesis));
 }
@@ -4,34 +4,11 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
 
 #include "fio.h"
 #include "os.h"
 
-static void fill_random_bytes(struct thread_data *td,
-			      unsigned char *p, unsigned int len)
-{
-	unsigned int todo;
-	double r;
-
-	while (len) {
-		r = os_random_double(&td->verify_state);
-
-		/*
-		 * lrand48_r seems to be broken and only fill the bottom
-		 * 32-bits, even on 64-bit archs with 64-bit longs
-		 */
-		todo = sizeof(r);
-		if (todo > len)
-			todo = len;
-
-		memcpy(p, &r, todo);
-
-		len -= todo;
-		p += todo;
-	}
-}
-
 static void hexdump(void *buffer, int len)
 {
 	unsigned char *p = buffer;
@@ -78,6 +55,40 @@ static int verify_io_u_md5(struct verify_header *hdr, struct io_u *io_u)
 	return 0;
 }
 
+static int verify_io_u_crc32c(struct verify_header *hdr, struct io_u *io_u)
+{
+	unsigned char *p = (unsigned char *) io_u->buf;
+	uint32_t c;
+
+	p += sizeof(*hdr);
+	c = crc32c(p, hdr->len - sizeof(*hdr));
+
+	if (c != hdr->crc32c) {
+		log_err("crc32c: verify failed at %llu/%u\n", io_u->offset, io_u->buflen);
+		log_err("crc32c: wanted %x, got %x\n", hdr->crc32c, c);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int verify_io_u_xxhash(struct verify_header *hdr, struct io_u *io_u)
+{
+	unsigned char *p = (unsigned char *) io_u->buf;
+	uint64_t h;
+
+	p += sizeof(*hdr);
+	h = xxh64(p, hdr->len - sizeof(*hdr), 0);
+
+	if (h != hdr->xxhash) {
+		log_err("xxhash: verify failed at %llu/%u\n", io_u->offset, io_u->buflen);
+		log_err("xxhash: wanted %llx, got %llx\n", (unsigned long long) hdr->xxhash, (unsigned long long) h);
+		return 1;
+	}
+
+	return 0;
+}
+
 static int verify_io_u(struct io_u *io_u)
 {
 	struct verify_header *hdr = (struct verify_header *) io_u->buf;
@@ -90,6 +101,10 @@ static int verify_io_u(struct io_u *io_u)
 		ret = verify_io_u_md5(hdr, io_u);
 	else if (hdr->verify_type == VERIFY_CRC32)
 		ret = verify_io_u_crc32(hdr, io_u);
+	else if (hdr->verify_type == VERIFY_CRC32C)
+		ret = verify_io_u_crc32c(hdr, io_u);
+	else if (hdr->verify_type == VERIFY_XXHASH)
+		ret = verify_io_u_xxhash(hdr, io_u);
 	else {
 		log_err("Bad verify type %u\n", hdr->verify_type);
 		ret = 1;
@@ -103,6 +118,16 @@ static void fill_crc32(struct verify_header *hdr, void *p, unsigned int len)
 	hdr->crc32 = crc32(p, len);
 }
 
+static void fill_crc32c(struct verify_header *hdr, void *p, unsigned int len)
+{
+	hdr->crc32c = crc32c(p, len);
+}
+
+static void fill_xxhash(struct verify_header *hdr, void *p, unsigned int len)
+{
+	hdr->xxhash = xxh64(p, len, 0);
+}
+
 static void fill_md5(struct verify_header *hdr, void *p, unsigned int len)
 {
 	struct md5_ctx md5_ctx;
@@ -124,11 +149,17 @@ void populate_verify_io_u(struct thread_data *td, struct io_u *io_u)
 	hdr.fio_magic = FIO_HDR_MAGIC;
 	hdr.len = io_u->buflen;
 	p += sizeof(hdr);
-	fill_random_bytes(td, p, io_u->buflen - sizeof(hdr));
+	fill_random_buf(&td->verify_state, p, io_u->buflen - sizeof(hdr));
 
 	if (td->verify == VERIFY_MD5) {
 		fill_md5(&hdr, p, io_u->buflen - sizeof(hdr));
 		hdr.verify_type = VERIFY_MD5;
+	} else if (td->verify == VERIFY_CRC32C) {
+		fill_crc32c(&hdr, p, io_u->buflen - sizeof(hdr));
+		hdr.verify_type = VERIFY_CRC32C;
+	} else if (td->verify == VERIFY_XXHASH) {
+		fill_xxhash(&hdr, p, io_u->buflen - sizeof(hdr));
+		hdr.verify_type = VERIFY_XXHASH;
 	} else {
 		fill_crc32(&hdr, p, io_u->buflen - sizeof(hdr));
 		hdr.verify_type = VERIFY_CRC32;
@@ -149,6 +180,7 @@ int get_next_verify(struct thread_data *td, struct io_u *io_u)
 		io_u->offset = ipo->offset;
 		io_u->buflen = ipo->len;
 		io_u->ddir = DDIR_READ;
+		io_u->file = ipo->file;
 		free(ipo);
 		return 0;
 	}
@@ -169,3 +201,237 @@ int do_io_u_verify(struct thread_data *td, struct io_u **io_u)
 
 	return ret;
 }
+
+/*
+ * Verifier threads. Completed verify reads are queued on verify_list, the
+ * threads check them and move them to verify_done_list. Only the job itself
+ * touches the io_u free list, it picks them up from there.
+ */
+static void *verify_async_thread(void *data)
+{
+	struct thread_data *td = data;
+	struct io_u *io_u;
+	int ret;
+
+	pthread_mutex_lock(&td->verify_lock);
+	for (;;) {
+		while (list_empty(&td->verify_list) && !td->verify_exit)
+			pthread_cond_wait(&td->verify_cond, &td->verify_lock);
+
+		if (list_empty(&td->verify_list))
+			break;
+
+		io_u = list_entry(td->verify_list.next, struct io_u, list);
+		list_del(&io_u->list);
+		pthread_mutex_unlock(&td->verify_lock);
+
+		ret = verify_io_u(io_u);
+
+		pthread_mutex_lock(&td->verify_lock);
+		if (ret)
+			td->verify_error = 1;
+		list_add_tail(&io_u->list, &td->verify_done_list);
+		pthread_cond_broadcast(&td->verify_cond);
+	}
+	pthread_mutex_unlock(&td->verify_lock);
+
+	return NULL;
+}
+
+int verify_async_init(struct thread_data *td)
+{
+	unsigned int i;
+
+	INIT_LIST_HEAD(&td->verify_list);
+	INIT_LIST_HEAD(&td->verify_done_list);
+	pthread_mutex_init(&td->verify_lock, NULL);
+	pthread_cond_init(&td->verify_cond, NULL);
+	td->verify_held = 0;
+	td->verify_exit = 0;
+	td->verify_error = 0;
+
+	td->verify_threads = malloc(td->verify_async * sizeof(pthread_t));
+	if (!td->verify_threads) {
+		td_verror(td, ENOMEM);
+		return 1;
+	}
+
+	for (i = 0; i < td->verify_async; i++) {
+		if (pthread_create(&td->verify_threads[i], NULL, verify_async_thread, td)) {
+			log_err("fio: failed to create verify thread\n");
+			break;
+		}
+	}
+
+	td->nr_verify_threads = i;
+	if (!i) {
+		free(td->verify_threads);
+		td->verify_threads = NULL;
+		td_verror(td, EAGAIN);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Let the threads drain verify_list and wait for them to exit. Anything
+ * they finished is reaped by the caller.
+ */
+void verify_async_exit(struct thread_data *td)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&td->verify_lock);
+	td->verify_exit = 1;
+	pthread_cond_broadcast(&td->verify_cond);
+	pthread_mutex_unlock(&td->verify_lock);
+
+	for (i = 0; i < td->nr_verify_threads; i++)
+		pthread_join(td->verify_threads[i], NULL);
+
+	free(td->verify_threads);
+	td->verify_threads = NULL;
+	td->nr_verify_threads = 0;
+}
+
+void verify_io_u_async(struct thread_data *td, struct io_u *io_u)
+{
+	io_u_clear_busy(td, io_u);
+
+	pthread_mutex_lock(&td->verify_lock);
+	list_add_tail(&io_u->list, &td->verify_list);
+	pthread_cond_signal(&td->verify_cond);
+	pthread_mutex_unlock(&td->verify_lock);
+
+	td->verify_held++;
+}
+
+/*
+ * Return verified io_u's to the free list. If wait is set and the threads
+ * still hold some, block until at least one is done. Returns 1 if any
+ * verify failed.
+ */
+int verify_async_reap(struct thread_data *td, int wait)
+{
+	struct io_u *io_u;
+	int ret;
+
+	pthread_mutex_lock(&td->verify_lock);
+	while (wait && td->verify_held && list_empty(&td->verify_done_list))
+		pthread_cond_wait(&td->verify_cond, &td->verify_lock);
+
+	while (!list_empty(&td->verify_done_list)) {
+		io_u = list_entry(td->verify_done_list.next, struct io_u, list);
+		list_del(&io_u->list);
+		put_io_u(td, io_u);
+		td->verify_held--;
+	}
+
+	ret = td->verify_error;
+	pthread_mutex_unlock(&td->verify_lock);
+	return ret;
+}
+
+/*
+ * Checksum throughput of each verify type, to help pick one
+ */
+#define CRCTEST_BUF_SIZE	(1024 * 1024)
+#define CRCTEST_MSEC		250
+
+static volatile unsigned long crctest_sink;
+
+static void crctest_md5(void *buf, unsigned int len)
+{
+	struct md5_ctx md5_ctx;
+
+	memset(&md5_ctx, 0, sizeof(md5_ctx));
+	md5_update(&md5_ctx, buf, len);
+	crctest_sink = md5_ctx.hash[0];
+}
+
+static void crctest_crc32(void *buf, unsigned int len)
+{
+	crctest_sink = crc32(buf, len);
+}
+
+static void crctest_crc32c_sw(void *buf, unsigned int len)
+{
+	crctest_sink = crc32c_sw(buf, len);
+}
+
+static void crctest_crc32c_hw(void *buf, unsigned int len)
+{
+	crctest_sink = crc32c_hw(buf, len);
+}
+
+static void crctest_xxhash(void *buf, unsigned int len)
+{
+	crctest_sink = xxh64(buf, len, 0);
+}
+
+static struct crctest {
+	const char *name;
+	void (*fn)(void *, unsigned int);
+	int hw;
+} crctests[] = {
+	{ .name = "md5",		.fn = crctest_md5, },
+	{ .name = "crc32",		.fn = crctest_crc32, },
+	{ .name = "crc32c",		.fn = crctest_crc32c_sw, },
+	{ .name = "crc32c-intel",	.fn = crctest_crc32c_hw, .hw = 1, },
+	{ .name = "xxhash",		.fn = crctest_xxhash, },
+	{ .name = NULL, },
+};
+
+int fio_crctest(const char *type)
+{
+	struct crctest *t;
+	struct timespec start;
+	unsigned long long bytes, nsec;
+	unsigned char *buf;
+	int i, found = 0;
+
+	buf = malloc(CRCTEST_BUF_SIZE);
+	if (!buf) {
+		log_err("fio: crctest: out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < CRCTEST_BUF_SIZE; i++)
+		buf[i] = rand();
+
+	for (t = crctests; t->name; t++) {
+		if (type && strcmp(type, t->name))
+			continue;
+
+		found = 1;
+		if (t->hw && !crc32c_hw_available()) {
+			printf("%-14s: not supported by this cpu\n", t->name);
+			continue;
+		}
+
+		/*
+		 * warm up caches before timing
+		 */
+		t->fn(buf, CRCTEST_BUF_SIZE);
+
+		bytes = 0;
+		fio_gettime(&start, NULL);
+		do {
+			t->fn(buf, CRCTEST_BUF_SIZE);
+			bytes += CRCTEST_BUF_SIZE;
+			nsec = ntime_since_now(&start);
+		} while (nsec < CRCTEST_MSEC * 1000000ULL);
+
+		printf("%-14s: %8.2f GB/s\n", t->name, (double) bytes / nsec);
+	}
+
+	free(buf);
+
+	if (!found) {
+		log_err("fio: crctest: md5, crc32, crc32c, crc32c-intel, xxhash\n");
+		return 1;
+	}
+
+	return 0;
+}
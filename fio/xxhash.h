@@ -0,0 +1,8 @@
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <stdint.h>
+
+extern uint64_t xxh64(const void *, unsigned long, uint64_t);
+
+#endif